@@ -0,0 +1,42 @@
+# include <stdio.h>
+# include <stdlib.h>
+# include <unistd.h>
+
+# include "lu_driver.hpp"
+
+void usage(const char* program)
+{
+    fprintf(stderr,"usage: %s -n size -t threads -e serial|pthread|omp|task|tiled [-b block size] [-i]\n",program);
+}
+
+int main(int argc, char* argv[])
+{
+    int N=0;
+    int threads=1;
+    int block=64;
+    const char* engine_name="serial";
+    int inverse=0;
+
+    int option;
+    while ((option=getopt(argc,argv,"n:t:e:b:i"))!=-1)
+    {
+        switch (option)
+        {
+            case 'n': N=atoi(optarg); break;
+            case 't': threads=atoi(optarg); break;
+            case 'e': engine_name=optarg; break;
+            case 'b': block=atoi(optarg); break;
+            case 'i': inverse=1; break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+
+    lu_engine* engine=make_engine(engine_name,threads,block);
+    if (N<=0 || engine==NULL)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    return run_lu(engine,N,block,inverse);
+}
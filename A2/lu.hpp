@@ -0,0 +1,163 @@
+#pragma once
+
+# include <stdlib.h>
+# include <stdio.h>
+# include <string.h>
+# include <time.h>
+
+# include <math.h>
+
+#ifndef _WIN32
+#define set_random drand48()*100
+#else
+#define set_random (double(rand())/RAND_MAX)
+#endif
+
+// n by n matrix of double precision, stored row by row in a single block
+struct matrix
+{
+    int n;
+    double* values;
+
+    double* operator[](int i) { return values+(size_t)i*n; }
+    const double* operator[](int i) const { return values+(size_t)i*n; }
+};
+
+inline matrix allocate_matrix(int n)
+{
+    matrix M;
+    M.n=n;
+    M.values=(double *)calloc((size_t)n*n,sizeof(double));
+    return M;
+}
+
+inline void free_matrix(matrix& M)
+{
+    free(M.values);
+    M.values=NULL;
+}
+
+inline void copy_matrix(const matrix& from, matrix& to)
+{
+    memcpy(to.values,from.values,(size_t)from.n*from.n*sizeof(double));
+}
+
+inline void seed_random()
+{
+    time_t t=time(NULL);
+
+    #ifndef _WIN32
+    srand48((unsigned int) t);
+    #else
+    srand((unsigned int) t);
+    #endif
+}
+
+inline void initialise(matrix& A) // fill A with random values
+{
+    for (int i=0; i<A.n; i++)
+    {
+        for (int j=0; j<A.n; j++)
+        {
+            A[i][j]=set_random;
+        }
+    }
+}
+
+inline void print_to_file(const matrix& values, const char* filename)
+{
+    FILE *f=fopen(filename,"w");
+    for (int i=0; i<values.n; i++)
+    {
+        for(int j=0; j<values.n; j++)
+        {
+            fprintf(f,"%f",values[i][j]);
+            fprintf(f," ");
+        }
+        fprintf(f,"\n");
+    }
+    fclose(f);
+}
+
+// expand the packed factors (unit L below the diagonal, U on and above it)
+// and the row permutation pi into explicit P, L and U matrices
+inline void unpack_factors(const matrix& lu, const int* pi, matrix& P, matrix& L, matrix& U)
+{
+    int n=lu.n;
+    for (int i=0; i<n; i++)
+    {
+        for (int j=0; j<n; j++)
+        {
+            P[i][j]=0.0;
+            L[i][j]=(i>j) ? lu[i][j] : (i==j ? 1.0 : 0.0);
+            U[i][j]=(i<=j) ? lu[i][j] : 0.0;
+        }
+        P[i][pi[i]]=1.0;
+    }
+}
+
+// squared Frobenius norm of PA-LU
+inline double verify(const matrix& A, const matrix& P, const matrix& L, const matrix& U)
+{
+    int n=A.n;
+    double sum=0.0;
+    double* row=(double *)calloc(n,sizeof(double));
+    for (int i=0; i<n; i++)
+    {
+        for (int j=0; j<n; j++)
+        {
+            row[j]=0.0;
+        }
+        for (int k=0; k<n; k++)
+        {
+            double p=P[i][k];
+            double l=L[i][k];
+            for (int j=0; j<n; j++)
+            {
+                row[j]=row[j] + p*A[k][j]-l*U[k][j];
+            }
+        }
+        for (int j=0; j<n; j++)
+        {
+            sum=sum+row[j]*row[j];
+        }
+    }
+    free(row);
+    return sum;
+}
+
+// squared Frobenius norm of A*Ainv-I
+inline double verify_inverse(const matrix& A, const matrix& Ainv)
+{
+    int n=A.n;
+    double sum=0.0;
+    double* row=(double *)calloc(n,sizeof(double));
+    for (int i=0; i<n; i++)
+    {
+        for (int j=0; j<n; j++)
+        {
+            row[j]=(i==j) ? -1.0 : 0.0;
+        }
+        for (int k=0; k<n; k++)
+        {
+            double a=A[i][k];
+            for (int j=0; j<n; j++)
+            {
+                row[j]=row[j] + a*Ainv[k][j];
+            }
+        }
+        for (int j=0; j<n; j++)
+        {
+            sum=sum+row[j]*row[j];
+        }
+    }
+    free(row);
+    return sum;
+}
+
+inline double wall_time() // in seconds
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC,&now);
+    return now.tv_sec+now.tv_nsec*1e-9;
+}
@@ -0,0 +1,3 @@
+#!/bin/bash
+g++ -g -O2 -Wall -fopenmp -o lu lu.cpp -lpthread -lm
+./lu "$@"
\ No newline at end of file
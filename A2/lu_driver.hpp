@@ -0,0 +1,70 @@
+#pragma once
+
+# include <stdio.h>
+# include <stdlib.h>
+
+# include "lu.hpp"
+# include "lu_engines.hpp"
+# include "lu_inverse.hpp"
+
+// factorize a random N x N matrix with the engine, which is deleted, write
+// the P, L, A and U files and print the time, the determinant and the error
+// magnitude; with inverse, also the inverse and its error. shared by lu.cpp,
+// which selects the engine, and openmp.cpp and pthread.cpp, which each run
+// one
+inline int run_lu(lu_engine* engine, int N, int block, int inverse)
+{
+    seed_random();
+
+    matrix a=allocate_matrix(N);
+    matrix copy=allocate_matrix(N);
+    initialise(a);
+    copy_matrix(a,copy);
+
+    int* pi=(int*)calloc(N,sizeof(int));
+
+    double start=wall_time();
+    engine->factorize(a,pi);
+    double time_elapsed=wall_time()-start; // in seconds
+
+    printf("Time elapsed (%f)",time_elapsed);
+
+    determinant det=lu_determinant(*engine,a,pi);
+    printf("log|det| (%f) sign (%d)",det.log_abs,det.sign);
+
+    matrix p=allocate_matrix(N);
+    matrix l=allocate_matrix(N);
+    matrix u=allocate_matrix(N);
+    unpack_factors(a,pi,p,l,u);
+
+    print_to_file(p,"P");
+    print_to_file(u,"U");
+    print_to_file(l,"L");
+    print_to_file(copy,"A");
+
+    double error=verify(copy,p,l,u);
+
+    printf("error magnitude (%f)", error);
+
+    if (inverse)
+    {
+        start=wall_time();
+        lu_inverse(*engine,a,pi,block);
+        time_elapsed=wall_time()-start;
+
+        printf("Inverse time elapsed (%f)",time_elapsed);
+
+        print_to_file(a,"Ainv");
+        printf("inverse error magnitude (%f)", verify_inverse(copy,a));
+    }
+
+    free_matrix(u);
+    free_matrix(l);
+    free_matrix(p);
+    free_matrix(copy);
+    free_matrix(a);
+    free(pi);
+    delete engine;
+
+    return 0;
+}
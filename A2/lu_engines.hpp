@@ -0,0 +1,440 @@
+#pragma once
+
+# include <string.h>
+# include <math.h>
+
+# include <functional>
+
+# include <pthread.h>
+# include <omp.h>
+
+# include "lu.hpp"
+
+const double threshold=1e-16; // keeps the multipliers finite for a zero pivot
+
+// body(begin,end) processes the rows [begin,end)
+typedef std::function<void(int,int)> row_range;
+
+// The engines differ only in how a range of independent rows is spread over
+// threads; the partial pivoting loop in factorize() is shared by all of them.
+class lu_engine
+{
+  public:
+    explicit lu_engine(int threads) : threads(threads < 1 ? 1 : threads) {}
+    virtual ~lu_engine() {}
+
+    virtual const char* name() const = 0;
+    virtual void parallel_for(int begin, int end, const row_range& body) = 0;
+
+    // in place factorization PA=LU of a; on return a holds the unit lower
+    // triangle L below the diagonal and U on and above it, and row i of PA
+    // is row pi[i] of A
+    virtual void factorize(matrix& a, int* pi);
+
+    int thread_count() const { return threads; }
+
+  protected:
+    int threads;
+};
+
+// bring the largest entry of column k (from row k down) onto the diagonal
+inline void pivot(matrix& a, int* pi, int k)
+{
+    int n=a.n;
+    double max=0.0;
+    int index=k; // k' that represents index of the max value observed
+    for (int i=k; i<n; i++)
+    {
+        if (max< fabs(a[i][k]))
+        {
+            max=fabs(a[i][k]);
+            index=i;
+        }
+    }
+
+    if (max==0.0)
+    {
+        printf("singular matrix");
+    }
+
+    if (index!=k)
+    {
+        int temp=pi[k];
+        pi[k]=pi[index];
+        pi[index]=temp;
+
+        // the row holds both the computed part of L and the rest of A
+        double* row_k=a[k];
+        double* row_index=a[index];
+        for (int j=0; j<n; j++)
+        {
+            double a_temp=row_k[j];
+            row_k[j]=row_index[j];
+            row_index[j]=a_temp;
+        }
+    }
+}
+
+// eliminate column k from row i over the columns [k+1,last)
+inline void eliminate_row(matrix& a, int i, int k, int last)
+{
+    double* row_i=a[i];
+    const double* row_k=a[k];
+    double l=row_i[k]=row_i[k]/(row_k[k]+threshold);
+    for (int j=k+1; j<last; j++)
+    {
+        row_i[j]=row_i[j]-l*row_k[j];
+    }
+}
+
+inline void lu_engine::factorize(matrix& a, int* pi)
+{
+    int n=a.n;
+    for (int i=0; i<n; i++)
+    {
+        pi[i]=i;
+    }
+
+    for (int k=0; k<n; k++)
+    {
+        pivot(a,pi,k);
+        parallel_for(k+1,n,[&a,k,n](int begin, int end)
+        {
+            for (int i=begin; i<end; i++)
+            {
+                eliminate_row(a,i,k,n);
+            }
+        });
+    }
+}
+
+
+class serial_engine : public lu_engine
+{
+  public:
+    serial_engine() : lu_engine(1) {}
+
+    const char* name() const { return "serial"; }
+
+    void parallel_for(int begin, int end, const row_range& body)
+    {
+        if (begin<end)
+        {
+            body(begin,end);
+        }
+    }
+};
+
+
+// A pool of threads-1 workers is created once and reused for every
+// parallel_for; the calling thread takes the first share of the rows.
+class pthread_engine : public lu_engine
+{
+  public:
+    explicit pthread_engine(int threads)
+      : lu_engine(threads), body(NULL), begin(0), end(0), generation(0), pending(0), stop(false)
+    {
+        pthread_mutex_init(&mutex,NULL);
+        pthread_cond_init(&start,NULL);
+        pthread_cond_init(&done,NULL);
+
+        workers=(pthread_t *)malloc(this->threads*sizeof(pthread_t));
+        ranks=(struct values_for_each_thread *)malloc(this->threads*sizeof(struct values_for_each_thread));
+        for (int i=1; i<this->threads; i++)
+        {
+            ranks[i].engine=this;
+            ranks[i].rank=i;
+            pthread_create(&workers[i],NULL,worker,(void*)&ranks[i]);
+        }
+    }
+
+    ~pthread_engine()
+    {
+        pthread_mutex_lock(&mutex);
+        stop=true;
+        pthread_cond_broadcast(&start);
+        pthread_mutex_unlock(&mutex);
+
+        for (int i=1; i<threads; i++)
+        {
+            pthread_join(workers[i],NULL);
+        }
+
+        free(workers);
+        free(ranks);
+        pthread_cond_destroy(&done);
+        pthread_cond_destroy(&start);
+        pthread_mutex_destroy(&mutex);
+    }
+
+    const char* name() const { return "pthread"; }
+
+    void parallel_for(int begin, int end, const row_range& body)
+    {
+        if (end-begin<threads)
+        {
+            if (begin<end)
+            {
+                body(begin,end);
+            }
+            return;
+        }
+
+        pthread_mutex_lock(&mutex);
+        this->body=&body;
+        this->begin=begin;
+        this->end=end;
+        pending=threads-1;
+        generation++;
+        pthread_cond_broadcast(&start);
+        pthread_mutex_unlock(&mutex);
+
+        run_share(0);
+
+        pthread_mutex_lock(&mutex);
+        while (pending>0)
+        {
+            pthread_cond_wait(&done,&mutex);
+        }
+        pthread_mutex_unlock(&mutex);
+    }
+
+  private:
+    struct values_for_each_thread
+    {
+        pthread_engine* engine;
+        int rank;
+    };
+
+    // same split as the original pthread code: equal shares, the last
+    // thread also takes the remaining rows
+    void run_share(int rank)
+    {
+        int num_of_elements=(end-begin)/threads;
+        int begin_in_thread=begin+num_of_elements*rank;
+        int last_in_thread=(rank==threads-1) ? end : begin_in_thread+num_of_elements;
+        (*body)(begin_in_thread,last_in_thread);
+    }
+
+    static void* worker(void* values_for_thread)
+    {
+        pthread_engine* engine=((struct values_for_each_thread*)values_for_thread)->engine;
+        int rank=((struct values_for_each_thread*)values_for_thread)->rank;
+        int seen=0;
+
+        while (true)
+        {
+            pthread_mutex_lock(&engine->mutex);
+            while (engine->generation==seen && !engine->stop)
+            {
+                pthread_cond_wait(&engine->start,&engine->mutex);
+            }
+            if (engine->stop)
+            {
+                pthread_mutex_unlock(&engine->mutex);
+                return NULL;
+            }
+            seen=engine->generation;
+            pthread_mutex_unlock(&engine->mutex);
+
+            engine->run_share(rank);
+
+            pthread_mutex_lock(&engine->mutex);
+            if (--engine->pending==0)
+            {
+                pthread_cond_signal(&engine->done);
+            }
+            pthread_mutex_unlock(&engine->mutex);
+        }
+    }
+
+    pthread_t* workers;
+    struct values_for_each_thread* ranks;
+    pthread_mutex_t mutex;
+    pthread_cond_t start;
+    pthread_cond_t done;
+
+    const row_range* body;
+    int begin;
+    int end;
+    int generation;
+    int pending;
+    bool stop;
+};
+
+
+class omp_loop_engine : public lu_engine
+{
+  public:
+    explicit omp_loop_engine(int threads) : lu_engine(threads) {}
+
+    const char* name() const { return "omp"; }
+
+    void parallel_for(int begin, int end, const row_range& body)
+    {
+        int i;
+
+        # pragma omp parallel for num_threads(threads) default(none) private(i) shared(begin,end,body) schedule(static)
+
+        for(i=begin; i<end; i++)
+        {
+            body(i,i+1);
+        }
+    }
+};
+
+
+// rows are handed out as tasks of a few rows each, so threads that finish
+// early pick up the remaining work
+class omp_task_engine : public lu_engine
+{
+  public:
+    explicit omp_task_engine(int threads) : lu_engine(threads) {}
+
+    const char* name() const { return "task"; }
+
+    void parallel_for(int begin, int end, const row_range& body)
+    {
+        int grain=(end-begin)/(4*threads);
+        if (grain<1)
+        {
+            grain=1;
+        }
+
+        # pragma omp parallel num_threads(threads) default(none) shared(begin,end,grain,body)
+        {
+            # pragma omp single
+            {
+                for (int i=begin; i<end; i+=grain)
+                {
+                    int last=(i+grain<end) ? i+grain : end;
+
+                    # pragma omp task default(none) firstprivate(i,last) shared(body)
+                    body(i,last);
+                }
+            }
+        }
+    }
+};
+
+
+// Blocked right-looking factorization: a panel of block columns is
+// factorized with partial pivoting, the block row of U is solved for, and the
+// trailing matrix is updated tile by tile so each tile stays in cache.
+class tiled_engine : public omp_loop_engine
+{
+  public:
+    tiled_engine(int threads, int block) : omp_loop_engine(threads), block(block < 1 ? 1 : block) {}
+
+    const char* name() const { return "tiled"; }
+
+    void factorize(matrix& a, int* pi)
+    {
+        int n=a.n;
+        for (int i=0; i<n; i++)
+        {
+            pi[i]=i;
+        }
+
+        for (int kb=0; kb<n; kb+=block)
+        {
+            int ke=(kb+block<n) ? kb+block : n;
+
+            // panel: only the columns [kb,ke) are updated
+            for (int k=kb; k<ke; k++)
+            {
+                pivot(a,pi,k);
+                parallel_for(k+1,n,[&a,k,ke](int begin, int end)
+                {
+                    for (int i=begin; i<end; i++)
+                    {
+                        eliminate_row(a,i,k,ke);
+                    }
+                });
+            }
+
+            if (ke==n)
+            {
+                break;
+            }
+
+            // block row of U: solve L11 U12 = A12, columns are independent
+            int column_tiles=(n-ke+block-1)/block;
+            parallel_for(0,column_tiles,[&a,kb,ke,n,this](int begin, int end)
+            {
+                for (int t=begin; t<end; t++)
+                {
+                    int jb=ke+t*block;
+                    int je=(jb+block<n) ? jb+block : n;
+                    for (int k=kb; k<ke; k++)
+                    {
+                        for (int i=k+1; i<ke; i++)
+                        {
+                            double l=a[i][k];
+                            for (int j=jb; j<je; j++)
+                            {
+                                a[i][j]=a[i][j]-l*a[k][j];
+                            }
+                        }
+                    }
+                }
+            });
+
+            // trailing update A22 = A22 - L21 U12, one tile at a time
+            int row_tiles=(n-ke+block-1)/block;
+            parallel_for(0,row_tiles*column_tiles,[&a,kb,ke,n,column_tiles,this](int begin, int end)
+            {
+                for (int t=begin; t<end; t++)
+                {
+                    int ib=ke+(t/column_tiles)*block;
+                    int ie=(ib+block<n) ? ib+block : n;
+                    int jb=ke+(t%column_tiles)*block;
+                    int je=(jb+block<n) ? jb+block : n;
+                    for (int i=ib; i<ie; i++)
+                    {
+                        double* row_i=a[i];
+                        for (int k=kb; k<ke; k++)
+                        {
+                            double l=row_i[k];
+                            const double* row_k=a[k];
+                            for (int j=jb; j<je; j++)
+                            {
+                                row_i[j]=row_i[j]-l*row_k[j];
+                            }
+                        }
+                    }
+                }
+            });
+        }
+    }
+
+  private:
+    int block;
+};
+
+
+// name is one of serial, pthread, omp, task or tiled; NULL if unknown
+inline lu_engine* make_engine(const char* name, int threads, int block)
+{
+    if (strcmp(name,"serial")==0)
+    {
+        return new serial_engine();
+    }
+    else if (strcmp(name,"pthread")==0)
+    {
+        return new pthread_engine(threads);
+    }
+    else if (strcmp(name,"omp")==0)
+    {
+        return new omp_loop_engine(threads);
+    }
+    else if (strcmp(name,"task")==0)
+    {
+        return new omp_task_engine(threads);
+    }
+    else if (strcmp(name,"tiled")==0)
+    {
+        return new tiled_engine(threads,block);
+    }
+    return NULL;
+}
@@ -0,0 +1,248 @@
+#pragma once
+
+# include <stdlib.h>
+# include <string.h>
+# include <math.h>
+
+# include "lu.hpp"
+# include "lu_engines.hpp"
+
+// Determinant and inverse of A from the packed factors left by
+// lu_engine::factorize. Both run on the engine that did the factorization,
+// so the pthread engine reuses its pool of workers.
+
+struct determinant
+{
+    double log_abs; // log of |det(A)|, -INFINITY for a singular matrix
+    int sign;       // -1, 0 or 1
+
+    double value() const { return sign==0 ? 0.0 : sign*exp(log_abs); }
+};
+
+// sign of the permutation pi, from the parity of its cycles
+inline int permutation_sign(const int* pi, int n)
+{
+    char* visited=(char *)calloc(n,sizeof(char));
+    int transpositions=0;
+    for (int i=0; i<n; i++)
+    {
+        int length=0;
+        for (int j=i; !visited[j]; j=pi[j])
+        {
+            visited[j]=1;
+            length++;
+        }
+        if (length>0)
+        {
+            transpositions+=length-1;
+        }
+    }
+    free(visited);
+    return (transpositions%2==0) ? 1 : -1;
+}
+
+// det(A)=sign(P)*u[0][0]*...*u[n-1][n-1], accumulated as a sum of logs so
+// large matrices do not overflow
+inline determinant lu_determinant(lu_engine& engine, const matrix& lu, const int* pi)
+{
+    int n=lu.n;
+    int chunks=engine.thread_count();
+    double* log_sum=(double *)calloc(chunks,sizeof(double));
+    int* negative=(int *)calloc(chunks,sizeof(int));
+    int* zero=(int *)calloc(chunks,sizeof(int));
+
+    engine.parallel_for(0,chunks,[&lu,n,chunks,log_sum,negative,zero](int begin, int end)
+    {
+        for (int c=begin; c<end; c++)
+        {
+            int first=(int)((long)n*c/chunks);
+            int last=(int)((long)n*(c+1)/chunks);
+            for (int i=first; i<last; i++)
+            {
+                double u=lu[i][i];
+                if (u==0.0)
+                {
+                    zero[c]=1;
+                }
+                else
+                {
+                    log_sum[c]+=log(fabs(u));
+                    negative[c]+=(u<0.0);
+                }
+            }
+        }
+    });
+
+    determinant det;
+    det.log_abs=0.0;
+    det.sign=permutation_sign(pi,n);
+    for (int c=0; c<chunks; c++)
+    {
+        det.log_abs+=log_sum[c];
+        if (negative[c]%2==1)
+        {
+            det.sign=-det.sign;
+        }
+        if (zero[c])
+        {
+            det.sign=0;
+        }
+    }
+    if (det.sign==0)
+    {
+        det.log_abs=-INFINITY;
+    }
+
+    free(zero);
+    free(negative);
+    free(log_sum);
+    return det;
+}
+
+// replace U (on and above the diagonal of a) by its inverse, one block
+// column at a time; work holds n by block doubles
+inline void invert_upper(lu_engine& engine, matrix& a, int block, double* work)
+{
+    int n=a.n;
+    for (int jb=0; jb<n; jb+=block)
+    {
+        int je=(jb+block<n) ? jb+block : n;
+        int width=je-jb;
+
+        // rows above the diagonal block: A12 = -inv(U11) A12 inv(U22),
+        // inv(U11) is already in place
+        for (int i=0; i<jb; i++)
+        {
+            memcpy(work+(size_t)i*width,a[i]+jb,width*sizeof(double));
+        }
+
+        engine.parallel_for(0,jb,[&a,jb,je,width,work](int begin, int end)
+        {
+            for (int i=begin; i<end; i++)
+            {
+                double* row_i=a[i];
+                for (int c=0; c<width; c++)
+                {
+                    row_i[jb+c]=0.0;
+                }
+                for (int k=i; k<jb; k++)
+                {
+                    double u=row_i[k];
+                    const double* w=work+(size_t)k*width;
+                    for (int c=0; c<width; c++)
+                    {
+                        row_i[jb+c]=row_i[jb+c]+u*w[c];
+                    }
+                }
+                for (int c=jb; c<je; c++)
+                {
+                    double x=row_i[c];
+                    for (int m=jb; m<c; m++)
+                    {
+                        x=x-row_i[m]*a[m][c];
+                    }
+                    row_i[c]=x/a[c][c];
+                }
+                for (int c=jb; c<je; c++)
+                {
+                    row_i[c]=-row_i[c];
+                }
+            }
+        });
+
+        // the diagonal block itself, column by column
+        for (int j=jb; j<je; j++)
+        {
+            a[j][j]=1.0/a[j][j];
+            double ajj=-a[j][j];
+            for (int i=jb; i<j; i++)
+            {
+                double x=0.0;
+                for (int k=i; k<j; k++)
+                {
+                    x=x+a[i][k]*a[k][j];
+                }
+                a[i][j]=x*ajj;
+            }
+        }
+    }
+}
+
+// overwrite the packed factors with inv(A)=inv(U) inv(L) P
+inline void lu_inverse(lu_engine& engine, matrix& a, const int* pi, int block)
+{
+    int n=a.n;
+    if (block<1)
+    {
+        block=1;
+    }
+    double* work=(double *)calloc((size_t)n*block,sizeof(double));
+
+    invert_upper(engine,a,block,work);
+
+    // solve X L = inv(U) for X, from the last block column back to the first
+    int last_block=((n-1)/block)*block;
+    for (int jb=last_block; jb>=0; jb-=block)
+    {
+        int je=(jb+block<n) ? jb+block : n;
+        int width=je-jb;
+
+        // move this block column of L into work and clear it in a
+        for (int i=jb; i<n; i++)
+        {
+            for (int c=0; c<width; c++)
+            {
+                int j=jb+c;
+                work[(size_t)i*block+c]=(i>j) ? a[i][j] : 0.0;
+                if (i>j)
+                {
+                    a[i][j]=0.0;
+                }
+            }
+        }
+
+        engine.parallel_for(0,n,[&a,jb,je,width,block,n,work](int begin, int end)
+        {
+            for (int i=begin; i<end; i++)
+            {
+                double* row_i=a[i];
+                for (int k=je; k<n; k++)
+                {
+                    double x=row_i[k];
+                    const double* w=work+(size_t)k*block;
+                    for (int c=0; c<width; c++)
+                    {
+                        row_i[jb+c]=row_i[jb+c]-x*w[c];
+                    }
+                }
+                for (int c=width-1; c>=0; c--)
+                {
+                    double x=row_i[jb+c];
+                    for (int m=c+1; m<width; m++)
+                    {
+                        x=x-row_i[jb+m]*work[(size_t)(jb+m)*block+c];
+                    }
+                    row_i[jb+c]=x;
+                }
+            }
+        });
+    }
+
+    // right multiply by P: column k moves to column pi[k]
+    engine.parallel_for(0,n,[&a,pi,n](int begin, int end)
+    {
+        double* row=(double *)malloc(n*sizeof(double));
+        for (int i=begin; i<end; i++)
+        {
+            double* row_i=a[i];
+            for (int k=0; k<n; k++)
+            {
+                row[pi[k]]=row_i[k];
+            }
+            memcpy(row_i,row,n*sizeof(double));
+        }
+        free(row);
+    });
+
+    free(work);
+}
@@ -1,3 +1,3 @@
 #!/bin/bash
-gcc -g -Wall -fopenmp -lm -o openmp openmp.cpp
+g++ -g -O2 -Wall -fopenmp -o openmp openmp.cpp -lpthread -lm
 ./openmp $1 $2
\ No newline at end of file
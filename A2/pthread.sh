@@ -1,3 +1,3 @@
 #!/bin/bash
-gcc -g -Wall -o pth pthread.cpp -lpthread -lm
+g++ -g -O2 -Wall -fopenmp -o pth pthread.cpp -lpthread -lm
 ./pth $1 $2
\ No newline at end of file
@@ -0,0 +1,96 @@
+// Counts the values of a skewed data set, in which one key has half of
+// the values, with a range_partitioner that spreads the hot key over
+// several partitions and the pipelined schedule policy, which reduces map
+// output while the map phase is still running. The counts are kept in
+// memory, and checked against those of the data set.
+//
+//    ./hot-keys.o
+
+#include <vector>
+#include <algorithm>
+#include <iostream>
+
+#include <boost/config.hpp>
+#include "mapreduce.hpp"
+
+using namespace std;
+
+int const num_keys  = 1000; // and the hot key
+int const hot_key   = num_keys;
+int const num_rows  = 2000;
+int const row_width = 200;
+
+vector< vector<int> > rows; // the values of each map key
+
+// every other value is the hot key, the rest cycle through the cold keys
+void create_values()
+{
+    rows.resize(num_rows);
+    for (int row=0; row<num_rows; ++row)
+    {
+        for (int column=0; column<row_width; ++column)
+            rows[row].push_back((column % 2 == 0)? hot_key : (row * row_width + column) / 2 % num_keys);
+    }
+}
+
+
+namespace count_of_values
+{
+struct map_task : public mapreduce::map_task<int, mapreduce::span<int const> >
+{
+    template<typename Runtime>
+    void operator()(Runtime &runtime, key_type const &, value_type const &value) const
+    {
+        for (auto ci = value.begin(); ci != value.end(); ci++)
+            runtime.emit_intermediate(*ci, 1LL);
+    }
+};
+
+typedef mapreduce::reducers::sum<int, long long> reduce_task;
+
+typedef mapreduce::job<count_of_values::map_task,count_of_values::reduce_task,mapreduce::null_combiner,
+mapreduce::datasource::container<count_of_values::map_task, vector< vector<int> > >,
+mapreduce::intermediates::in_memory<count_of_values::map_task,count_of_values::reduce_task,int,mapreduce::range_partitioner<int> > > job;
+
+}
+
+
+int main()
+{
+    create_values();
+
+    mapreduce::specification spec;
+    mapreduce::results result;
+    spec.reduce_tasks = 8;
+    spec.pipeline_buffer_keys = 16;
+    spec.pipeline_queue_length = 2;
+
+    // the hot key has half of the sample, so is given half of the partitions
+    count_of_values::job::datasource_type sample_datasource(rows);
+    auto const sample = mapreduce::sample_intermediate_keys<int, count_of_values::map_task>(sample_datasource, 100);
+    mapreduce::range_partitioner<int> partitioner(sample, spec.reduce_tasks);
+
+    count_of_values::job::datasource_type datasource(rows);
+    count_of_values::job job(datasource, spec);
+    job.partitioner(partitioner);
+
+    mapreduce::thread_pool pool(4);
+    job.run<mapreduce::schedule_policy::pipelined<count_of_values::job> >(pool, result);
+
+    long long hot_count = 0;
+    long long total     = 0;
+    size_t    keys      = 0;
+    for (auto it=job.begin_results(); it!=job.end_results(); ++it)
+    {
+        if (it->first == hot_key)
+            hot_count += it->second;
+        total += it->second;
+        ++keys;
+    }
+
+    long long const values = (long long)num_rows * row_width;
+    cout << keys << " keys, " << partitioner.spread_keys().size() << " spread, "
+         << hot_count << " of " << values / 2 << " hot values and "
+         << total << " of " << values << " values counted\n";
+    return (hot_count == values / 2  &&  total == values  &&  keys == size_t(num_keys + 1))? 0 : 1;
+}
@@ -0,0 +1,92 @@
+// Counts the outgoing links of each node of a graph, in the edge list
+// format that mr-pr-cpp reads, with a job that keeps its intermediate
+// values on local disk under integer keys. The counts are written to one
+// file per partition, named <output>1_of_<n> and so on.
+//
+//    ./out-degree.o graph.txt -o graph-out-degree-
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+
+#include <boost/config.hpp>
+#include "mapreduce.hpp"
+
+using namespace std;
+
+vector< vector<int> > rows; // the nodes that link to each node
+size_t num_edges = 0;
+
+void add_edge(int from, int to)
+{
+    size_t maximum_dimension=max(from,to);
+    if (rows.size()<=maximum_dimension)
+        rows.resize(maximum_dimension+1);
+
+    rows[to].push_back(from);
+    ++num_edges;
+}
+
+void create_graph_from_inputfile(char* input)
+{
+    int from;
+    int to;
+    ifstream input_file(input);
+
+    while (input_file >> from >> to)
+        add_edge(from,to);
+}
+
+
+namespace computation_of_out_degree
+{
+struct map_task : public mapreduce::map_task<int, mapreduce::span<int const> >
+{
+    // one for the node at the start of each link to the node `key`
+    template<typename Runtime>
+    void operator()(Runtime &runtime, key_type const &, value_type const &value) const
+    {
+        for (auto ci = value.begin(); ci != value.end(); ci++)
+            runtime.emit_intermediate(*ci, 1LL);
+    }
+};
+
+typedef mapreduce::reducers::sum<int, long long> reduce_task;
+
+typedef mapreduce::job<computation_of_out_degree::map_task,computation_of_out_degree::reduce_task,mapreduce::null_combiner,
+mapreduce::datasource::container<computation_of_out_degree::map_task, vector< vector<int> > >,
+mapreduce::intermediates::local_disk<computation_of_out_degree::map_task,computation_of_out_degree::reduce_task> > job;
+
+}
+
+
+int main(int argc, char *argv[])
+{
+    if (argc < 4)
+    {
+        cerr << "usage: " << argv[0] << " graph.txt -o output-prefix\n";
+        return 1;
+    }
+
+    create_graph_from_inputfile(argv[1]);
+
+    mapreduce::specification spec;
+    mapreduce::results result;
+    spec.output_filespec = argv[3];
+    spec.reduce_tasks = std::max(1U, std::thread::hardware_concurrency());
+
+    computation_of_out_degree::job::datasource_type datasource(rows);
+    computation_of_out_degree::job job(datasource, spec);
+
+    // every link is counted once, at the node it leaves
+    job.result_reduction([](int, long long count) {
+        return double(count);
+    });
+    job.run<mapreduce::schedule_policy::cpu_parallel<computation_of_out_degree::job> >(result);
+    long long const links = (long long)result.result_reduction;
+
+    cout << result.counters.reduce_keys_completed << " nodes with links, " << links << " of " << num_edges << " links counted\n";
+    return (size_t(links) == num_edges)? 0 : 1;
+}
@@ -0,0 +1,269 @@
+// Copyright (c) 2009-2016 Craig Henderson
+// https://github.com/cdmh/mapreduce
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+
+#if __cplusplus >= 201703L  &&  defined(__has_include)
+#if __has_include(<memory_resource>)
+#include <memory_resource>
+#define MAPREDUCE_HAS_MEMORY_RESOURCE
+#endif
+#endif
+
+namespace mapreduce {
+
+namespace detail {
+
+// the allocations of the arenas of a job's intermediate stores, see
+// arena_allocator
+struct arena_counters
+{
+    arena_counters()
+    {
+        reset();
+    }
+
+    void reset()
+    {
+        allocations          = 0;
+        upstream_allocations = 0;
+        peak_bytes           = 0;
+    }
+
+    void add(uintmax_t const arena_allocations, uintmax_t const arena_upstream_allocations, size_t const arena_bytes)
+    {
+        allocations          += arena_allocations;
+        upstream_allocations += arena_upstream_allocations;
+
+        size_t peak = peak_bytes.load(std::memory_order_relaxed);
+        while (arena_bytes > peak  &&  !peak_bytes.compare_exchange_weak(peak, arena_bytes))
+            ;
+    }
+
+    std::atomic<uintmax_t> allocations;             // made from an arena
+    std::atomic<uintmax_t> upstream_allocations;    // blocks the arenas took from the heap
+    std::atomic<size_t>    peak_bytes;              // the largest arena
+};
+
+#ifdef MAPREDUCE_HAS_MEMORY_RESOURCE
+
+// The memory of one partition of an intermediate store. Allocations are
+// taken from blocks of a std::pmr::monotonic_buffer_resource, never freed
+// one at a time, and the blocks are all returned to the heap when the arena
+// is destroyed, once the partition has been reduced or merged into another
+// store. An arena is used by one thread at a time.
+class arena : noncopyable
+{
+  public:
+    explicit arena(arena_counters *counters = 0)
+      : counters_(counters),
+        resource_(&upstream_)
+    {
+    }
+
+    ~arena()
+    {
+        report();
+    }
+
+    void counters(arena_counters *counters)
+    {
+        counters_ = counters;
+    }
+
+    void *allocate(size_t const bytes, size_t const alignment)
+    {
+        ++allocations_;
+        return resource_.allocate(bytes, alignment);
+    }
+
+    // add the allocations since the last report to the counters
+    void report()
+    {
+        if (counters_)
+            counters_->add(allocations_ - reported_, upstream_.allocations - reported_upstream_, upstream_.bytes);
+        reported_          = allocations_;
+        reported_upstream_ = upstream_.allocations;
+    }
+
+  private:
+    // the heap, counting the blocks that the arena takes from it
+    class upstream_resource : public std::pmr::memory_resource
+    {
+      public:
+        uintmax_t allocations = 0;
+        size_t    bytes       = 0;
+
+      private:
+        void *do_allocate(size_t const size, size_t const alignment) override
+        {
+            ++allocations;
+            bytes += size;
+            return std::pmr::new_delete_resource()->allocate(size, alignment);
+        }
+
+        void do_deallocate(void *p, size_t const size, size_t const alignment) override
+        {
+            std::pmr::new_delete_resource()->deallocate(p, size, alignment);
+        }
+
+        bool do_is_equal(std::pmr::memory_resource const &other) const noexcept override
+        {
+            return this == &other;
+        }
+    };
+
+    arena_counters                      *counters_;
+    upstream_resource                    upstream_;
+    std::pmr::monotonic_buffer_resource  resource_;
+    uintmax_t                            allocations_       = 0;
+    uintmax_t                            reported_          = 0;
+    uintmax_t                            reported_upstream_ = 0;
+};
+
+#endif  // MAPREDUCE_HAS_MEMORY_RESOURCE
+
+}   // namespace detail
+
+#ifdef MAPREDUCE_HAS_MEMORY_RESOURCE
+
+// An allocator for the containers of an intermediate store, such as
+// intermediates::in_memory, that takes memory from the arena of a partition
+// and frees nothing until the arena is destroyed. A default constructed
+// allocator uses the heap. Unlike std::pmr::polymorphic_allocator, the
+// allocator moves with the contents of a container when it is swapped or
+// assigned, so a store can hand a partition and its arena to another.
+template<typename T>
+class arena_allocator
+{
+  public:
+    typedef T              value_type;
+    typedef std::true_type propagate_on_container_copy_assignment;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    arena_allocator() : arena_(0)
+    {
+    }
+
+    explicit arena_allocator(detail::arena *arena) : arena_(arena)
+    {
+    }
+
+    template<typename U>
+    arena_allocator(arena_allocator<U> const &other) : arena_(other.arena())
+    {
+    }
+
+    T *allocate(size_t const count)
+    {
+        if (arena_)
+            return static_cast<T *>(arena_->allocate(count * sizeof(T), alignof(T)));
+        return std::allocator<T>().allocate(count);
+    }
+
+    void deallocate(T *p, size_t const count)
+    {
+        if (!arena_)
+            std::allocator<T>().deallocate(p, count);
+    }
+
+    detail::arena *arena() const
+    {
+        return arena_;
+    }
+
+  private:
+    detail::arena *arena_;
+};
+
+template<typename T, typename U>
+bool const operator==(arena_allocator<T> const &left, arena_allocator<U> const &right)
+{
+    return left.arena() == right.arena();
+}
+
+template<typename T, typename U>
+bool const operator!=(arena_allocator<T> const &left, arena_allocator<U> const &right)
+{
+    return left.arena() != right.arena();
+}
+
+// the Allocator of the intermediate stores unless one is given
+typedef arena_allocator<char> default_store_allocator;
+
+#else
+
+typedef std::allocator<char> default_store_allocator;
+
+#endif  // MAPREDUCE_HAS_MEMORY_RESOURCE
+
+namespace detail {
+
+// The arena that an intermediate store keeps for each partition, for its
+// Allocator, and the allocator that takes memory from it. An allocator other
+// than arena_allocator has no arena, and is default constructed.
+template<typename Allocator>
+struct store_arena
+{
+    struct type
+    {
+        explicit type(arena_counters *)
+        {
+        }
+
+        void counters(arena_counters *)
+        {
+        }
+
+        void report()
+        {
+        }
+    };
+
+    static Allocator const allocator(type &)
+    {
+        return Allocator();
+    }
+};
+
+#ifdef MAPREDUCE_HAS_MEMORY_RESOURCE
+template<typename T>
+struct store_arena<arena_allocator<T>>
+{
+    typedef arena type;
+
+    static arena_allocator<T> const allocator(type &arena)
+    {
+        return arena_allocator<T>(&arena);
+    }
+};
+#endif
+
+}   // namespace detail
+
+}   // namespace mapreduce
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
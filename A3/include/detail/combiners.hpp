@@ -0,0 +1,174 @@
+// Copyright (c) 2009-2016 Craig Henderson
+// https://github.com/cdmh/mapreduce
+
+#pragma once
+
+#include <functional>
+
+namespace mapreduce {
+
+namespace detail {
+
+struct add_values
+{
+    template<typename T>
+    T const operator()(T const &left, T const &right) const
+    {
+        return left + right;
+    }
+};
+
+struct min_value
+{
+    template<typename T>
+    T const operator()(T const &left, T const &right) const
+    {
+        return (right < left)? right : left;
+    }
+};
+
+struct max_value
+{
+    template<typename T>
+    T const operator()(T const &left, T const &right) const
+    {
+        return (left < right)? right : left;
+    }
+};
+
+// the number of values a combiner folded into an earlier value of the
+// same key, for combiners that count them
+template<typename Combiner>
+auto values_folded(Combiner const &combiner, int) -> decltype(size_t(combiner.values_folded()))
+{
+    return combiner.values_folded();
+}
+
+template<typename Combiner>
+size_t const values_folded(Combiner const &, ...)
+{
+    return 0;
+}
+
+}   // namespace detail
+
+namespace combiners {
+
+// Folds the values that a map task emits for each key into one value with
+// a binary operation, which must be associative and commutative. With an
+// intermediate store that supports it, see detail::can_combine_on_insert,
+// each value is folded into the key's value as it is emitted; otherwise the
+// map task's values are folded after the task, by start/operator()/finish.
+template<typename Value, typename Op>
+class fold_with
+{
+  public:
+    typedef Value value_type;
+
+    fold_with() : have_value_(false), folded_(0)
+    {
+    }
+
+    explicit fold_with(Op const &op) : op_(op), have_value_(false), folded_(0)
+    {
+    }
+
+    void fold(Value &accumulated, Value const &value) const
+    {
+        accumulated = op_(accumulated, value);
+    }
+
+    template<typename Key>
+    void start(Key const &)
+    {
+        have_value_ = false;
+    }
+
+    void operator()(Value const &value)
+    {
+        if (have_value_)
+        {
+            fold(value_, value);
+            ++folded_;
+        }
+        else
+        {
+            value_      = value;
+            have_value_ = true;
+        }
+    }
+
+    template<typename Key, typename IntermediateStore>
+    void finish(Key const &key, IntermediateStore &intermediate_store)
+    {
+        if (have_value_)
+            intermediate_store.insert(key, value_);
+    }
+
+    size_t const values_folded() const
+    {
+        return folded_;
+    }
+
+  private:
+    Op     op_;
+    Value  value_;
+    bool   have_value_;
+    size_t folded_;
+};
+
+template<typename Value>
+struct sum : fold_with<Value, detail::add_values>
+{
+};
+
+template<typename Value>
+struct min : fold_with<Value, detail::min_value>
+{
+};
+
+template<typename Value>
+struct max : fold_with<Value, detail::max_value>
+{
+};
+
+// folds with a function given at run time, such as a lambda
+//     job.combiner(mapreduce::combiners::function<double>(
+//         [](double left, double right) { return left + right; }));
+// a job default constructs its combiner, so one of these must be given to
+// the job with job::combiner before it is run
+template<typename Value>
+struct function : fold_with<Value, std::function<Value (Value const &, Value const &)>>
+{
+    typedef std::function<Value (Value const &, Value const &)> function_type;
+
+    function()
+    {
+    }
+
+    explicit function(function_type const &fn) : fold_with<Value, function_type>(fn)
+    {
+    }
+};
+
+}   // namespace combiners
+
+}   // namespace mapreduce
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
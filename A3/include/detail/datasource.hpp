@@ -4,12 +4,35 @@
 #pragma once
 
 #include <boost/iostreams/device/mapped_file.hpp>
+#include <algorithm>
+#include <atomic>
 #include <mutex>
+#include <type_traits>
+#include <utility>
 
 namespace mapreduce {
 
 namespace datasource {
 
+// A datasource may optionally hand out a block of keys at a time with
+//     size_t const setup_keys(Key *keys, size_t const max_keys);
+// which fills up to max_keys keys and returns how many it filled, 0 when
+// there are none left. It is called concurrently without a lock, so is
+// typically a claim on an atomic counter. Datasources without it are read
+// a key at a time through setup_key under the schedule's lock.
+template<typename Datasource, typename Key>
+class has_setup_keys
+{
+    template<typename D>
+    static auto test(int) -> decltype(std::declval<D &>().setup_keys(std::declval<Key *>(), size_t()), std::true_type());
+
+    template<typename D>
+    static std::false_type test(...);
+
+  public:
+    static bool const value = decltype(test<Datasource>(0))::value;
+};
+
 namespace detail {
 
 template<typename Key, typename Value>
@@ -167,6 +190,19 @@ file_handler<
     return true;
 }
 
+// a map value that is a span views the element; any other is given a copy
+template<typename T, typename Element>
+void assign_value(span<T> &value, Element const &element)
+{
+    value = span<T>(element.data(), element.size());
+}
+
+template<typename Value, typename Element>
+void assign_value(Value &value, Element const &element)
+{
+    value = element;
+}
+
 }   // namespace detail
 
 template<
@@ -218,6 +254,226 @@ class directory_iterator : mapreduce::detail::noncopyable
     FileHandler                     file_handler_;
 };
 
+// The elements of a container in memory, such as a std::vector, as map
+// values, keyed by their index. With a map value type of span<T const> the
+// map task reads each element in place, without copying or allocating.
+// Keys are claimed with an atomic counter. The container must outlive the
+// datasource and not change while the job runs.
+template<typename MapTask, typename Container>
+class container : mapreduce::detail::noncopyable
+{
+  public:
+    explicit container(Container const &elements)
+      : elements_(elements),
+        next_(0)
+    {
+    }
+
+    // hand out the keys again from the first, for a job that is run again,
+    // see iterative_job
+    void rewind()
+    {
+        next_ = 0;
+    }
+
+    bool const setup_key(typename MapTask::key_type &key)
+    {
+        return setup_keys(&key, 1) == 1;
+    }
+
+    size_t const setup_keys(typename MapTask::key_type *keys, size_t const max_keys)
+    {
+        size_t const first = next_.fetch_add(max_keys);
+        size_t const last  = std::min<size_t>(first + max_keys, elements_.size());
+        for (size_t index=first; index<last; ++index)
+            *keys++ = typename MapTask::key_type(index);
+        return (first < last)? last - first : 0;
+    }
+
+    bool const get_data(typename MapTask::key_type const &key, typename MapTask::value_type &value) const
+    {
+        detail::assign_value(value, elements_[key]);
+        return true;
+    }
+
+  private:
+    Container const     &elements_;
+    std::atomic<size_t>  next_;         // the next index to claim
+};
+
+// a key of segmented_directory: a line aligned piece of an input file
+struct file_segment
+{
+    std::string    filename;
+    std::uintmax_t offset;
+    std::uintmax_t size;
+};
+
+// Scans the input directory when it is constructed, memory maps every file
+// and divides them all into line aligned segments of about
+// specification::max_file_segment_size bytes, in parallel. The segments are
+// published as an index that map threads claim from with an atomic counter,
+// so several files are mapped at the same time and no lock is taken per
+// key. The value of a key is its segment of the mapped file. A boundary is
+// the first '\n' or '\r' at or after a multiple of the segment size, as in
+// directory_iterator, so lines longer than a segment are not divided.
+template<typename MapTask>
+class segmented_directory : mapreduce::detail::noncopyable
+{
+  public:
+    explicit segmented_directory(mapreduce::specification const &spec)
+      : next_(0)
+    {
+        scan(spec);
+    }
+
+    size_t const size() const
+    {
+        return segments_.size();
+    }
+
+    // hand out the keys again from the first, for a job that is run again,
+    // see iterative_job
+    void rewind()
+    {
+        next_ = 0;
+    }
+
+    bool const setup_key(typename MapTask::key_type &key)
+    {
+        return setup_keys(&key, 1) == 1;
+    }
+
+    size_t const setup_keys(typename MapTask::key_type *keys, size_t const max_keys)
+    {
+        size_t const first = next_.fetch_add(max_keys);
+        size_t const last  = std::min(first + max_keys, segments_.size());
+        for (size_t index=first; index<last; ++index)
+            *keys++ = segments_[index];
+        return (first < last)? last - first : 0;
+    }
+
+    bool const get_data(typename MapTask::key_type const &key, typename MapTask::value_type &value) const
+    {
+        auto const file = files_.find(key.filename);
+        if (file == files_.end())
+            return false;
+
+        value.first  = file->second->data() + key.offset;
+        value.second = key.size;
+        return true;
+    }
+
+  private:
+    typedef std::shared_ptr<boost::iostreams::mapped_file_source> mapped_file_t;
+
+    void scan(mapreduce::specification const &spec)
+    {
+        std::vector<std::string> filenames;
+        for (boost::filesystem::directory_iterator it(spec.input_directory), end; it!=end; ++it)
+        {
+            if (!boost::filesystem::is_directory(*it))
+                filenames.push_back(it->path().string());
+        }
+        std::sort(filenames.begin(), filenames.end());
+
+        // map the files, and find the boundaries of their segments, by
+        // dividing the nominal boundaries of all the files between threads
+        std::vector<mapped_file_t>               mapped(filenames.size());
+        std::vector<std::vector<std::uintmax_t>> boundaries(filenames.size());
+        std::uintmax_t const segment_size = std::max<std::uintmax_t>(1, spec.max_file_segment_size);
+        run_in_parallel(filenames.size(), [&](size_t const index) {
+            map_file(filenames[index], mapped[index]);
+            if (mapped[index])
+                boundaries[index].resize(size_t((mapped[index]->size() + segment_size - 1) / segment_size) + 1);
+        });
+
+        std::vector<std::pair<size_t, size_t>> nominal;     // file and boundary index
+        for (size_t index=0; index<filenames.size(); ++index)
+        {
+            if (!mapped[index])
+                continue;
+
+            boundaries[index].front() = 0;
+            boundaries[index].back()  = mapped[index]->size();
+            for (size_t boundary=1; boundary+1<boundaries[index].size(); ++boundary)
+                nominal.push_back(std::make_pair(index, boundary));
+        }
+
+        run_in_parallel(nominal.size(), [&](size_t const index) {
+            auto const &file = *mapped[nominal[index].first];
+            char const *const data = file.data();
+            std::uintmax_t offset = nominal[index].second * segment_size;
+            while (offset < file.size()  &&  data[offset] != '\n'  &&  data[offset] != '\r')
+                ++offset;
+            boundaries[nominal[index].first][nominal[index].second] = offset;
+        });
+
+        // publish the index
+        for (size_t index=0; index<filenames.size(); ++index)
+        {
+            if (!mapped[index])
+                continue;
+
+            files_[filenames[index]] = mapped[index];
+            auto const &bounds = boundaries[index];
+            for (size_t boundary=0; boundary+1<bounds.size(); ++boundary)
+            {
+                // a line longer than a segment leaves empty segments
+                if (bounds[boundary+1] > bounds[boundary])
+                {
+                    file_segment const segment = { filenames[index], bounds[boundary], bounds[boundary+1] - bounds[boundary] };
+                    segments_.push_back(segment);
+                }
+            }
+        }
+    }
+
+    static void map_file(std::string const &filename, mapped_file_t &mapped)
+    {
+        try
+        {
+            if (boost::filesystem::file_size(filename) == 0)
+                return;
+
+            mapped = std::make_shared<boost::iostreams::mapped_file_source>(filename);
+        }
+        catch (std::exception &)
+        {
+            mapped.reset();
+        }
+
+        if (!mapped  ||  !mapped->is_open())
+        {
+            std::cerr << "\nFailed to map file into memory: " << filename;
+            mapped.reset();
+        }
+    }
+
+    // run fn(index) for every index in [0, count), on up to one thread per core
+    template<typename Fn>
+    static void run_in_parallel(size_t const count, Fn fn)
+    {
+        std::atomic<size_t> next(0);
+        auto const worker = [&next, count, &fn]() {
+            for (size_t index=next++; index<count; index=next++)
+                fn(index);
+        };
+
+        size_t const num_threads = std::min<size_t>(count, std::max(1U, std::thread::hardware_concurrency()));
+        mapreduce::detail::joined_thread_group threads;
+        for (size_t loop=1; loop<num_threads; ++loop)
+            threads.emplace_back(worker);
+        worker();
+        threads.join_all();
+    }
+
+  private:
+    std::map<std::string, mapped_file_t>  files_;
+    std::vector<file_segment>             segments_;
+    std::atomic<size_t>                   next_;        // the next segment to claim
+};
+
 }   // namespace datasource
 
 }   // namespace mapreduce 
@@ -0,0 +1,239 @@
+// Copyright (c) 2009-2016 Craig Henderson
+// https://github.com/cdmh/mapreduce
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+namespace mapreduce {
+
+// A histogram of durations in fixed memory, for the map, shuffle and reduce
+// times of a job. Durations are counted in nanoseconds, in buckets of eight
+// to each power of two, so a percentile is within about 6% of the duration
+// it estimates whatever the number recorded. Recording is a few integer
+// operations, without allocation.
+class latency_histogram
+{
+  public:
+    typedef std::chrono::duration<double> duration_type;    // seconds
+
+    latency_histogram()
+    {
+        clear();
+    }
+
+    void clear()
+    {
+        buckets_.fill(0);
+        count_ = 0;
+        total_ = 0;
+        min_   = std::numeric_limits<uint64_t>::max();
+        max_   = 0;
+    }
+
+    template<typename Rep, typename Period>
+    void record(std::chrono::duration<Rep, Period> const &time)
+    {
+        auto const nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(time).count();
+        uint64_t const value = (nanoseconds > 0)? uint64_t(nanoseconds) : 0;
+
+        ++buckets_[bucket(value)];
+        ++count_;
+        total_ += value;
+        min_    = std::min(min_, value);
+        max_    = std::max(max_, value);
+    }
+
+    void merge(latency_histogram const &other)
+    {
+        for (size_t loop=0; loop<buckets; ++loop)
+            buckets_[loop] += other.buckets_[loop];
+        count_ += other.count_;
+        total_ += other.total_;
+        min_    = std::min(min_, other.min_);
+        max_    = std::max(max_, other.max_);
+    }
+
+    bool const empty() const
+    {
+        return count_ == 0;
+    }
+
+    uint64_t const count() const
+    {
+        return count_;
+    }
+
+    duration_type const total() const
+    {
+        return seconds(total_);
+    }
+
+    duration_type const mean() const
+    {
+        return empty()? duration_type(0) : seconds(total_) / double(count_);
+    }
+
+    duration_type const min() const
+    {
+        return empty()? duration_type(0) : seconds(min_);
+    }
+
+    duration_type const max() const
+    {
+        return seconds(max_);
+    }
+
+    // the duration that percent of those recorded did not exceed, such as
+    // percentile(99) for p99; the middle of its bucket
+    duration_type const percentile(double const percent) const
+    {
+        if (empty())
+            return duration_type(0);
+
+        uint64_t const rank = std::max<uint64_t>(1, uint64_t(std::ceil(count_ * std::min(100.0, std::max(0.0, percent)) / 100.0)));
+        uint64_t seen = 0;
+        for (size_t loop=0; loop<buckets; ++loop)
+        {
+            seen += buckets_[loop];
+            if (seen >= rank)
+            {
+                uint64_t const middle = lower_bound(loop) + (upper_bound(loop) - lower_bound(loop)) / 2;
+                return seconds(std::min(max_, std::max(min_, middle)));
+            }
+        }
+        return max();
+    }
+
+    // {"count":n,"total":s,"mean":s,"min":s,"max":s,"p50":s,"p90":s,"p99":s}
+    void to_json(std::ostream &stream) const
+    {
+        stream << "{\"count\":" << count()
+               << ",\"total\":" << total().count()
+               << ",\"mean\":"  << mean().count()
+               << ",\"min\":"   << min().count()
+               << ",\"max\":"   << max().count()
+               << ",\"p50\":"   << percentile(50).count()
+               << ",\"p90\":"   << percentile(90).count()
+               << ",\"p99\":"   << percentile(99).count()
+               << "}";
+    }
+
+  private:
+    // values below 16 have a bucket each; above, eight to a power of two
+    static size_t const sub_buckets = 8;
+    static size_t const buckets     = 16 + (64 - 4) * sub_buckets;
+
+    static size_t const bucket(uint64_t const value)
+    {
+        if (value < 16)
+            return size_t(value);
+
+        size_t const exponent = log2(value);
+        return 16 + (exponent - 4) * sub_buckets + size_t((value >> (exponent - 3)) & (sub_buckets - 1));
+    }
+
+    static uint64_t const lower_bound(size_t const index)
+    {
+        if (index < 16)
+            return index;
+
+        size_t const exponent = 4 + (index - 16) / sub_buckets;
+        return (uint64_t(sub_buckets + (index - 16) % sub_buckets)) << (exponent - 3);
+    }
+
+    static uint64_t const upper_bound(size_t const index)
+    {
+        if (index < 16)
+            return index;
+        return lower_bound(index) + (uint64_t(1) << (4 + (index - 16) / sub_buckets - 3)) - 1;
+    }
+
+    static size_t const log2(uint64_t value)
+    {
+        size_t exponent = 0;
+        while (value >>= 1)
+            ++exponent;
+        return exponent;
+    }
+
+    static duration_type const seconds(uint64_t const nanoseconds)
+    {
+        return duration_type(nanoseconds * 1e-9);
+    }
+
+  private:
+    std::array<uint64_t, buckets> buckets_;
+    uint64_t                      count_;
+    uint64_t                      total_;     // nanoseconds
+    uint64_t                      min_;
+    uint64_t                      max_;
+};
+
+namespace detail {
+
+// lock mutex, adding the time spent waiting for it to wait, and recording
+// the wait with the tracer, if any. an uncontended lock is not timed, so
+// costs no more than a plain lock
+template<typename Mutex>
+std::unique_lock<Mutex> lock_timed(Mutex &mutex, std::chrono::duration<double> &wait, mapreduce::tracer *tracer = 0)
+{
+    std::unique_lock<Mutex> lock(mutex, std::try_to_lock);
+    if (!lock.owns_lock())
+    {
+        auto const start_time = std::chrono::steady_clock::now();
+        lock.lock();
+        wait += std::chrono::steady_clock::now() - start_time;
+        if (tracer)
+            tracer->record("lock wait", start_time);
+    }
+    return lock;
+}
+
+template<typename T>
+void json_array(std::ostream &stream, std::vector<T> const &values)
+{
+    stream << "[";
+    for (size_t loop=0; loop<values.size(); ++loop)
+        stream << (loop? ",":"") << values[loop];
+    stream << "]";
+}
+
+template<typename Rep, typename Period>
+void json_array(std::ostream &stream, std::vector<std::chrono::duration<Rep, Period>> const &values)
+{
+    stream << "[";
+    for (size_t loop=0; loop<values.size(); ++loop)
+        stream << (loop? ",":"") << std::chrono::duration<double>(values[loop]).count();
+    stream << "]";
+}
+
+}   // namespace detail
+
+}   // namespace mapreduce
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
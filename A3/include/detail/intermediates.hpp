@@ -2,8 +2,11 @@
 // https://github.com/cdmh/mapreduce
 
 #include "hash_partitioner.hpp"
+#include "range_partitioner.hpp"
 #include "intermediates/in_memory.hpp"
+#include "intermediates/flat_in_memory.hpp"
 #include "intermediates/local_disk.hpp"
+#include "intermediates/hybrid.hpp"
 
 // Permission is hereby granted, free of charge, to any person obtaining a copy
 // of this software and associated documentation files (the "Software"), to deal
@@ -0,0 +1,565 @@
+// Copyright (c) 2009-2016 Craig Henderson
+// https://github.com/cdmh/mapreduce
+
+#pragma once
+
+#include <atomic>
+#include <limits>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <boost/functional/hash.hpp>
+#include <boost/iterator/iterator_facade.hpp>
+
+namespace mapreduce {
+
+namespace detail {
+
+// open addressing (linear probing) table of keys, each key owning a
+// contiguous vector of values. keys are kept in insertion order, so the
+// table is only sorted when ordered output is requested
+template<typename Key, typename Value, typename Hash=boost::hash<Key>>
+class flat_key_table
+{
+  public:
+    typedef Key                key_type;
+    typedef std::vector<Value> values_type;
+
+    flat_key_table() : mask_(0), shift_(64)
+    {
+    }
+
+    size_t const size() const
+    {
+        return keys_.size();
+    }
+
+    bool const empty() const
+    {
+        return keys_.empty();
+    }
+
+    key_type const &key(size_t const index) const
+    {
+        return keys_[index];
+    }
+
+    values_type &values(size_t const index)
+    {
+        return values_[index];
+    }
+
+    values_type const &values(size_t const index) const
+    {
+        return values_[index];
+    }
+
+    // the values of key, inserting an empty entry if key is not present
+    values_type &operator[](key_type const &key)
+    {
+        if ((keys_.size()+1)*2 > slots_.size())
+            grow();
+
+        size_t slot = home_slot(key);
+        while (slots_[slot] != 0)
+        {
+            size_t const index = slots_[slot] - 1;
+            if (keys_[index] == key)
+                return values_[index];
+            slot = (slot + 1) & mask_;
+        }
+
+        slots_[slot] = keys_.size() + 1;
+        keys_.push_back(key);
+        values_.push_back(values_type());
+        return values_.back();
+    }
+
+    // indices of the keys in ascending KeyCompare order
+    template<typename KeyCompare>
+    std::vector<size_t> sorted_order(KeyCompare const &compare) const
+    {
+        std::vector<size_t> order(keys_.size());
+        for (size_t loop=0; loop<order.size(); ++loop)
+            order[loop] = loop;
+
+        std::sort(
+            order.begin(),
+            order.end(),
+            [this, &compare](size_t const left, size_t const right) {
+                return compare(keys_[left], keys_[right]);
+            });
+        return order;
+    }
+
+    void swap(flat_key_table &other)
+    {
+        using std::swap;
+        swap(keys_,   other.keys_);
+        swap(values_, other.values_);
+        swap(slots_,  other.slots_);
+        swap(mask_,   other.mask_);
+        swap(shift_,  other.shift_);
+    }
+
+    void clear()
+    {
+        flat_key_table().swap(*this);
+    }
+
+  private:
+    // fibonacci hashing spreads keys whose hashes share their low bits, which
+    // is the case for every key of a partition chosen by hash % partitions
+    size_t const home_slot(key_type const &key) const
+    {
+        uint64_t const hash = static_cast<uint64_t>(Hash()(key));
+        return static_cast<size_t>((hash * 11400714819323198485ULL) >> shift_) & mask_;
+    }
+
+    void grow()
+    {
+        size_t const capacity = std::max<size_t>(16, slots_.size() * 2);
+        slots_.assign(capacity, 0);
+        mask_  = capacity - 1;
+        shift_ = 64;
+        for (size_t size=capacity; size>1; size>>=1)
+            --shift_;
+
+        for (size_t index=0; index<keys_.size(); ++index)
+        {
+            size_t slot = home_slot(keys_[index]);
+            while (slots_[slot] != 0)
+                slot = (slot + 1) & mask_;
+            slots_[slot] = index + 1;
+        }
+    }
+
+  private:
+    std::vector<key_type>    keys_;
+    std::vector<values_type> values_;
+    std::vector<size_t>      slots_;    // index+1 into keys_, 0 for an empty slot
+    size_t                   mask_;
+    unsigned                 shift_;
+};
+
+}   // namespace detail
+
+namespace intermediates {
+
+// An in-memory intermediate store that groups each partition in a
+// detail::flat_key_table rather than a std::map of vectors. Emitting a
+// value is a hash probe and a vector push_back, and keys are sorted only
+// when the results are iterated in order. Partitions are reduced in the
+// order their keys were first emitted.
+template<
+    typename MapTask,
+    typename ReduceTask,
+    typename KeyType     = typename ReduceTask::key_type,
+    typename PartitionFn = mapreduce::hash_partitioner,
+    typename KeyCompare  = std::less<typename ReduceTask::key_type>,
+    typename StoreResult = reduce_null_output<MapTask, ReduceTask>
+>
+class flat_in_memory : detail::noncopyable
+{
+  public:
+    typedef KeyType                         key_type;
+    typedef typename ReduceTask::value_type value_type;
+    typedef MapTask                         map_task_type;
+    typedef ReduceTask                      reduce_task_type;
+    typedef StoreResult                     store_result_type;
+
+  private:
+    typedef detail::flat_key_table<KeyType, value_type> table_t;
+    typedef std::vector<table_t>                        intermediates_t;
+
+  public:
+    typedef
+    std::pair<KeyType, value_type>
+    keyvalue_t;
+
+    class const_result_iterator
+      : public boost::iterator_facade<
+            const_result_iterator,
+            keyvalue_t const,
+            boost::forward_traversal_tag>
+    {
+        friend class boost::iterator_core_access;
+
+      public:
+        const_result_iterator(const_result_iterator const &) = default;
+
+      private:
+        // ordered iterates the results in KeyCompare order, merging the
+        // partitions; otherwise one partition follows another, each in the
+        // order its keys were first emitted
+        const_result_iterator(flat_in_memory const *outer, bool const ordered)
+          : outer_(outer),
+            ordered_(ordered),
+            current_(std::numeric_limits<size_t>::max()),
+            value_index_(0)
+        {
+            assert(outer_);
+        }
+
+        const_result_iterator &operator=(const_result_iterator const &other);
+
+        void increment()
+        {
+            table_t const &table = outer_->intermediates_[current_];
+            size_t  const  key   = key_index(current_);
+            if (++value_index_ == table.values(key).size())
+            {
+                size_t const partition = current_;
+                if (ordered_)
+                    heap_.pop(before());
+
+                ++positions_[partition];
+                if (ordered_  &&  !exhausted(partition))
+                    heap_.push(partition, before());
+
+                set_current();
+            }
+            else
+                value_ = std::make_pair(table.key(key), table.values(key)[value_index_]);
+        }
+
+        bool const equal(const_result_iterator const &other) const
+        {
+            if (current_ == std::numeric_limits<size_t>::max()  ||  other.current_ == std::numeric_limits<size_t>::max())
+                return other.current_ == current_;
+            return value_ == other.value_;
+        }
+
+        const_result_iterator &begin()
+        {
+            // sort each partition once, the iterator copies share the orders
+            if (ordered_)
+            {
+                orders_ = std::make_shared<std::vector<std::vector<size_t>>>(outer_->num_partitions_);
+                for (size_t loop=0; loop<outer_->num_partitions_; ++loop)
+                    (*orders_)[loop] = outer_->intermediates_[loop].sorted_order(KeyCompare());
+            }
+            positions_.assign(outer_->num_partitions_, 0);
+
+            heap_.clear();
+            for (size_t loop=0; ordered_  &&  loop<outer_->num_partitions_; ++loop)
+            {
+                if (!exhausted(loop))
+                    heap_.push(loop, before());
+            }
+            current_ = 0;
+            set_current();
+            return *this;
+        }
+
+        const_result_iterator &end()
+        {
+            current_ = std::numeric_limits<size_t>::max();
+            value_ = keyvalue_t();
+            positions_.clear();
+            heap_.clear();
+            return *this;
+        }
+
+        keyvalue_t const &dereference() const
+        {
+            return value_;
+        }
+
+        bool const exhausted(size_t const partition) const
+        {
+            return positions_[partition] == outer_->intermediates_[partition].size();
+        }
+
+        // index in the partition's table of its current key
+        size_t const key_index(size_t const partition) const
+        {
+            return ordered_? (*orders_)[partition][positions_[partition]] : positions_[partition];
+        }
+
+        key_type const &current_key(size_t const partition) const
+        {
+            return outer_->intermediates_[partition].key(key_index(partition));
+        }
+
+        // partitions by current key, equal keys from the lowest partition first
+        struct before_t
+        {
+            const_result_iterator const *it;
+
+            bool const operator()(size_t const left, size_t const right) const
+            {
+                KeyCompare const compare;
+                return compare(it->current_key(left), it->current_key(right))
+                   ||  (!compare(it->current_key(right), it->current_key(left))  &&  left < right);
+            }
+        };
+
+        before_t before() const
+        {
+            return before_t{this};
+        }
+
+        void set_current()
+        {
+            size_t const num_partitions = outer_->num_partitions_;
+            if (ordered_)
+                current_ = heap_.empty()? num_partitions : heap_.top();
+            else
+            {
+                while (current_<num_partitions  &&  exhausted(current_))
+                    ++current_;
+            }
+
+            if (current_ == num_partitions)
+                end();
+            else
+            {
+                table_t const &table = outer_->intermediates_[current_];
+                size_t  const  key   = key_index(current_);
+                value_index_ = 0;
+                value_ = std::make_pair(table.key(key), table.values(key)[0]);
+            }
+        }
+
+      private:
+        flat_in_memory const                             *outer_;       // parent container
+        bool                                              ordered_;     // merge the partitions in key order
+        std::shared_ptr<std::vector<std::vector<size_t>>> orders_;      // sorted key indices per partition, if ordered_
+        std::vector<size_t>                               positions_;   // position in each partition
+        detail::partition_heap                            heap_;        // partitions not yet exhausted, if ordered_
+        size_t                                            current_;     // partition of the current element
+        size_t                                            value_index_; // index in the current key's values
+        keyvalue_t                                        value_;       // value of current element
+
+        friend class flat_in_memory;
+    };
+    friend class const_result_iterator;
+
+    explicit flat_in_memory(size_t const num_partitions=1)
+      : num_partitions_(num_partitions)
+    {
+        intermediates_.resize(num_partitions_);
+    }
+
+    // called by the job, see job::partitioner
+    void partitioner(PartitionFn const &fn)
+    {
+        partitioner_ = fn;
+    }
+
+    const_result_iterator begin_results() const
+    {
+        return const_result_iterator(this, true).begin();
+    }
+
+    const_result_iterator end_results() const
+    {
+        return const_result_iterator(this, true).end();
+    }
+
+    // the results partition by partition, without sorting or merging
+    const_result_iterator begin_unordered_results() const
+    {
+        return const_result_iterator(this, false).begin();
+    }
+
+    const_result_iterator end_unordered_results() const
+    {
+        return const_result_iterator(this, false).end();
+    }
+
+    void swap(flat_in_memory &other)
+    {
+        using std::swap;
+        swap(intermediates_, other.intermediates_);
+    }
+
+    void run_intermediate_results_shuffle(size_t const /*partition*/)
+    {
+    }
+
+    template<typename Callback>
+    void reduce(size_t const partition, Callback &callback)
+    {
+        table_t table;
+        table.swap(intermediates_[partition]);
+
+        for (size_t index=0; index<table.size(); ++index)
+            callback(table.key(index), detail::values_begin(table.values(index)), detail::values_end(table.values(index)));
+    }
+
+    size_t const partition_key_count(size_t const partition) const
+    {
+        return intermediates_[partition].size();
+    }
+
+    // detach the table of a partition and divide its keys into at most
+    // `pieces` ranges, each reduced by reduce(partition, piece, callback)
+    size_t const split_partition(size_t const partition, size_t const pieces)
+    {
+        if (!splits_)
+            splits_.reset(new split_t[num_partitions_]);
+
+        split_t &split = splits_[partition];
+        split.table.clear();
+        split.table.swap(intermediates_[partition]);
+        split.pieces    = std::max<size_t>(1, std::min(pieces, split.table.size()));
+        split.remaining = split.pieces;
+        return split.pieces;
+    }
+
+    template<typename Callback>
+    void reduce(size_t const partition, size_t const piece, Callback &callback)
+    {
+        split_t      &split = splits_[partition];
+        size_t const  keys  = split.table.size();
+        for (size_t index=keys*piece/split.pieces; index<keys*(piece+1)/split.pieces; ++index)
+            callback(split.table.key(index), detail::values_begin(split.table.values(index)), detail::values_end(split.table.values(index)));
+
+        // the last piece to finish releases the partition's table
+        if (--split.remaining == 0)
+            split.table.clear();
+    }
+
+    void merge_from(size_t partition, flat_in_memory &other)
+    {
+        table_t &table       = intermediates_[partition];
+        table_t &other_table = other.intermediates_[partition];
+
+        if (table.empty())
+        {
+            table.swap(other_table);
+            return;
+        }
+
+        for (size_t index=0; index<other_table.size(); ++index)
+        {
+            auto const &values = other_table.values(index);
+            auto       &merged = table[other_table.key(index)];
+            merged.insert(merged.end(), values.cbegin(), values.cend());
+        }
+        other_table.clear();
+    }
+
+    void merge_from(flat_in_memory &other)
+    {
+        for (size_t partition=0; partition<num_partitions_; ++partition)
+            merge_from(partition, other);
+    }
+
+    template<typename T>
+    bool const insert(T const &key, typename reduce_task_type::value_type const &value)
+    {
+        return insert(make_intermediate_key<key_type>(key), value);
+    }
+
+    // receive final result
+    bool const insert(typename reduce_task_type::key_type   const &key,
+                      typename reduce_task_type::value_type const &value,
+                      StoreResult &store_result)
+    {
+        return store_result(key, value)  &&  insert(key, value);
+    }
+
+    // receive intermediate result
+    bool const insert(key_type                              const &key,
+                      typename reduce_task_type::value_type const &value)
+    {
+        size_t const partition = (num_partitions_ == 1)? 0 : partitioner_(key, num_partitions_);
+        return insert(partition, key, value);
+    }
+
+    // receive intermediate result for a given partition, whichever partition
+    // the partitioner would choose, see job::combine_partition
+    bool const insert(size_t                                const  partition,
+                      key_type                              const &key,
+                      typename reduce_task_type::value_type const &value)
+    {
+        intermediates_[partition][key].push_back(value);
+        return true;
+    }
+
+    template<typename T, typename Combiner>
+    bool const insert_combined(T const &key, typename reduce_task_type::value_type const &value, Combiner const &combiner)
+    {
+        return insert_combined(make_intermediate_key<key_type>(key), value, combiner);
+    }
+
+    // receive intermediate result, folding it into the value already held
+    // for the key, see detail::can_combine_on_insert
+    template<typename Combiner>
+    bool const insert_combined(key_type                              const &key,
+                               typename reduce_task_type::value_type const &value,
+                               Combiner                              const &combiner)
+    {
+        size_t const  partition = (num_partitions_ == 1)? 0 : partitioner_(key, num_partitions_);
+        auto         &values    = intermediates_[partition][key];
+        if (values.empty())
+        {
+            values.push_back(value);
+            return false;
+        }
+
+        combiner.fold(values.front(), value);
+        return true;
+    }
+
+    template<typename FnObj>
+    void combine(FnObj &fn_obj)
+    {
+        intermediates_t intermediates(num_partitions_);
+        using std::swap;
+        swap(intermediates_, intermediates);
+
+        for (auto const &table : intermediates)
+        {
+            for (size_t index=0; index<table.size(); ++index)
+            {
+                fn_obj.start(table.key(index));
+                for (auto const &value : table.values(index))
+                    fn_obj(value);
+                fn_obj.finish(table.key(index), *this);
+            }
+        }
+    }
+
+    void combine(null_combiner &)
+    {
+    }
+
+  private:
+    struct split_t
+    {
+        table_t             table;
+        size_t              pieces;
+        std::atomic<size_t> remaining;
+    };
+
+    size_t const               num_partitions_;
+    intermediates_t            intermediates_;
+    PartitionFn                partitioner_;
+    std::unique_ptr<split_t[]> splits_;     // partitions detached by split_partition
+};
+
+}   // namespace intermediates
+
+}   // namespace mapreduce
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
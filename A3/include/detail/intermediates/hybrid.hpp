@@ -0,0 +1,461 @@
+// Copyright (c) 2009-2016 Craig Henderson
+// https://github.com/cdmh/mapreduce
+
+#pragma once
+
+#include "local_disk.hpp"
+
+namespace mapreduce {
+
+namespace intermediates {
+
+// Intermediate values are held in memory, as in in_memory, until the
+// estimated memory of all partitions reaches the store's budget, its share
+// of specification::spill_memory_budget (see job::map_store_budget). The
+// largest partitions are then written to sorted runs in RecordFormat, and
+// compressed if specification::spill_compression is set, until half of the
+// budget is left in memory. A partition that is never spilled never
+// touches the disk. In the shuffle the runs of a partition are merged by
+// MergeFn, and the reduce merges the merged run with the values still in
+// memory, key by key.
+// The partitions spilled, and how often, are given in
+// results::partition_spills.
+//
+// The results are written by the StoreResult, such as reduce_file_output,
+// or to a target, and are not kept, so begin_results() == end_results().
+template<
+    typename MapTask,
+    typename ReduceTask,
+    typename KeyType         = typename ReduceTask::key_type,
+    typename PartitionFn     = hash_partitioner,
+    typename StoreResultType = reduce_file_output<MapTask, ReduceTask>,
+    typename RecordFormat    = binary_records<typename ReduceTask::key_type, typename ReduceTask::value_type>,
+    typename MergeFn         = detail::file_merger<RecordFormat> >
+class hybrid : detail::noncopyable
+{
+  public:
+    typedef MapTask                         map_task_type;
+    typedef ReduceTask                      reduce_task_type;
+    typedef KeyType                         key_type;
+    typedef typename ReduceTask::value_type value_type;
+    typedef StoreResultType                 store_result_type;
+    typedef RecordFormat                    record_format_type;
+
+    typedef
+    std::pair<
+        typename reduce_task_type::key_type,
+        typename reduce_task_type::value_type>
+    keyvalue_t;
+
+    typedef typename std::vector<keyvalue_t>::const_iterator const_result_iterator;
+
+  private:
+    struct partition_t
+    {
+        typedef std::map<key_type, std::vector<value_type>> values_t;
+
+        values_t                values;                 // in memory
+        size_t                  bytes = 0;              // estimated memory held by values
+        std::list<std::string>  fragment_filenames;     // sorted runs spilled
+        std::string             filename;               // the runs merged, after the shuffle
+    };
+
+  public:
+    explicit hybrid(size_t const num_partitions)
+      : num_partitions_(num_partitions),
+        partitions_(num_partitions),
+        memory_budget_(0),
+        buffered_bytes_(0),
+        spill_counters_(0)
+    {
+    }
+
+    ~hybrid()
+    {
+        try
+        {
+            // delete the temporary files
+            for (auto const &part : partitions_)
+            {
+                if (!part.filename.empty())
+                    detail::delete_file(part.filename);
+                for (auto const &filename : part.fragment_filenames)
+                    detail::delete_file(filename);
+            }
+        }
+        catch (std::exception const &e)
+        {
+            std::cerr << "\nError: " << e.what() << "\n";
+        }
+    }
+
+    // called by the job, see detail::has_configure_spill. without a budget
+    // the store is in_memory
+    void configure_spill(detail::spill_settings const &settings)
+    {
+        memory_budget_  = settings.memory_budget;
+        spill_counters_ = settings.counters;
+        codec_          = detail::block_codec(settings.codec, settings.counters);
+    }
+
+    // called by the job, see job::partitioner
+    void partitioner(PartitionFn const &fn)
+    {
+        partitioner_ = fn;
+    }
+
+    const_result_iterator begin_results() const
+    {
+        return results_.cbegin();
+    }
+
+    const_result_iterator end_results() const
+    {
+        return results_.cend();
+    }
+
+    const_result_iterator begin_unordered_results() const
+    {
+        return results_.cbegin();
+    }
+
+    const_result_iterator end_unordered_results() const
+    {
+        return results_.cend();
+    }
+
+    template<typename T>
+    bool const insert(T const &key, value_type const &value)
+    {
+        return insert(make_intermediate_key<key_type>(key), value);
+    }
+
+    // receive final result
+    template<typename StoreResult>
+    bool const insert(typename reduce_task_type::key_type   const &key,
+                      typename reduce_task_type::value_type const &value,
+                      StoreResult                                 &store_result)
+    {
+        store_result(key, value);
+        return true;
+    }
+
+    // receive intermediate result
+    bool const insert(key_type const &key, value_type const &value)
+    {
+        partition_t &part   = partitions_[partition_of(key)];
+        auto const   values = values_of(part, key);
+        add_bytes(part, values.second + value_size(value));
+        values.first->push_back(value);
+        spill_if_over_budget();
+        return true;
+    }
+
+    template<typename T, typename Combiner>
+    bool const insert_combined(T const &key, value_type const &value, Combiner const &combiner)
+    {
+        return insert_combined(make_intermediate_key<key_type>(key), value, combiner);
+    }
+
+    // receive intermediate result, folding it into the value already held
+    // for the key, see detail::can_combine_on_insert
+    template<typename Combiner>
+    bool const insert_combined(key_type const &key, value_type const &value, Combiner const &combiner)
+    {
+        partition_t &part   = partitions_[partition_of(key)];
+        auto const   values = values_of(part, key);
+        if (values.first->empty())
+        {
+            add_bytes(part, values.second + value_size(value));
+            values.first->push_back(value);
+            spill_if_over_budget();
+            return false;
+        }
+
+        combiner.fold(values.first->front(), value);
+        return true;
+    }
+
+    template<typename FnObj>
+    void combine(FnObj &fn_obj)
+    {
+        std::vector<partition_t> partitions(num_partitions_);
+        for (size_t partition=0; partition<num_partitions_; ++partition)
+        {
+            using std::swap;
+            swap(partitions[partition].values, partitions_[partition].values);
+            partitions_[partition].bytes = 0;
+        }
+        buffered_bytes_ = 0;
+
+        for (auto const &part : partitions)
+        {
+            for (auto const &kv : part.values)
+            {
+                fn_obj.start(kv.first);
+                for (auto const &value : kv.second)
+                    fn_obj(value);
+                fn_obj.finish(kv.first, *this);
+            }
+        }
+    }
+
+    void combine(null_combiner &)
+    {
+    }
+
+    void merge_from(hybrid &other)
+    {
+        assert(num_partitions_ == other.num_partitions_);
+        for (size_t partition=0; partition<num_partitions_; ++partition)
+            merge_from(partition, other);
+    }
+
+    // partitions may be merged concurrently, so once the store is over its
+    // budget only the partition being merged is spilled, if it holds at
+    // least its share of the budget
+    void merge_from(size_t const partition, hybrid &other)
+    {
+        partition_t &to   = partitions_[partition];
+        partition_t &from = other.partitions_[partition];
+
+        if (to.values.empty())
+        {
+            using std::swap;
+            swap(to.values, from.values);
+        }
+        else
+        {
+            for (auto &kv : from.values)
+            {
+                auto &values = to.values[kv.first];
+                values.insert(values.end(), kv.second.cbegin(), kv.second.cend());
+            }
+            from.values.clear();
+        }
+        add_bytes(to, from.bytes);
+        other.buffered_bytes_ -= from.bytes;
+        from.bytes = 0;
+        to.fragment_filenames.splice(to.fragment_filenames.end(), from.fragment_filenames);
+
+        if (memory_budget_ > 0
+        &&  buffered_bytes_ >= memory_budget_
+        &&  to.bytes > 0
+        &&  to.bytes >= memory_budget_ / num_partitions_)
+        {
+            count_spill(spill(partition));
+        }
+    }
+
+    void run_intermediate_results_shuffle(size_t const partition)
+    {
+        partition_t &part = partitions_[partition];
+        if (part.fragment_filenames.size() == 1)
+        {
+            // a single run is already sorted
+            part.filename = part.fragment_filenames.front();
+            part.fragment_filenames.clear();
+        }
+        else if (!part.fragment_filenames.empty())
+        {
+            MergeFn merge_fn;
+            part.filename = platform::get_temporary_filename();
+            merge_fn(part.fragment_filenames, part.filename, &codec_);
+            part.fragment_filenames.clear();
+        }
+    }
+
+    // the keys of the merged run and of the values in memory are both in
+    // order, so are merged as they are read
+    template<typename Callback>
+    void reduce(size_t const partition, Callback &callback)
+    {
+        partition_t &part = partitions_[partition];
+
+        typename partition_t::values_t values;
+        std::string                    filename;
+        using std::swap;
+        swap(values, part.values);
+        swap(filename, part.filename);
+        buffered_bytes_ -= part.bytes;
+        part.bytes = 0;
+
+        if (filename.empty())
+        {
+            for (auto const &kv : values)
+                callback(kv.first, detail::values_begin(kv.second), detail::values_end(kv.second));
+            return;
+        }
+
+        {
+            typename record_format_type::record_type kv;
+            typename reduce_task_type::key_type      key;
+            std::vector<value_type>                  merged;
+
+            detail::record_reader infile(filename, 1 << 20, false, &codec_);
+            bool have_record = record_format_type::read(infile, kv);
+            auto memory      = values.begin();
+            while (have_record  ||  memory != values.end())
+            {
+                if (!have_record  ||  (memory != values.end()  &&  memory->first < kv.first))
+                {
+                    callback(memory->first, detail::values_begin(memory->second), detail::values_end(memory->second));
+                    ++memory;
+                    continue;
+                }
+
+                merged.clear();
+                swap(key, kv.first);
+                do
+                {
+                    merged.push_back(kv.second);
+                    have_record = record_format_type::read(infile, kv);
+                } while (have_record  &&  kv.first == key);
+
+                if (memory != values.end()  &&  memory->first == key)
+                {
+                    merged.insert(merged.end(), memory->second.cbegin(), memory->second.cend());
+                    ++memory;
+                }
+                callback(key, detail::values_begin(merged), detail::values_end(merged));
+            }
+        }
+
+        detail::delete_file(filename.c_str());
+    }
+
+  private:
+    size_t const partition_of(key_type const &key)
+    {
+        return (num_partitions_ == 1)? 0 : partitioner_(key, num_partitions_);
+    }
+
+    // the values of key, and the estimated bytes of memory added if key was
+    // not present
+    std::pair<std::vector<value_type> *, size_t> const values_of(partition_t &part, key_type const &key)
+    {
+        auto const inserted = part.values.insert(std::make_pair(key, std::vector<value_type>()));
+        if (!inserted.second)
+            return std::make_pair(&inserted.first->second, size_t(0));
+
+        // the map node is the key, the vector and three pointers and a colour
+        return std::make_pair(
+            &inserted.first->second,
+            sizeof(typename partition_t::values_t::value_type) + 4 * sizeof(void *) + detail::dynamic_size(key));
+    }
+
+    static size_t const value_size(value_type const &value)
+    {
+        return sizeof(value_type) + detail::dynamic_size(value);
+    }
+
+    void add_bytes(partition_t &part, size_t const bytes)
+    {
+        part.bytes      += bytes;
+        buffered_bytes_ += bytes;
+    }
+
+    // spill the largest partitions until half of the budget is left, so a
+    // store close to its budget does not spill again on every insert
+    void spill_if_over_budget()
+    {
+        if (memory_budget_ == 0  ||  buffered_bytes_ < memory_budget_)
+            return;
+
+        uintmax_t bytes = 0;
+        while (buffered_bytes_ > memory_budget_ / 2)
+        {
+            auto const largest =
+                std::max_element(
+                    partitions_.cbegin(),
+                    partitions_.cend(),
+                    [](partition_t const &left, partition_t const &right) {
+                        return left.bytes < right.bytes;
+                    });
+            if (largest->bytes == 0)
+                break;
+            bytes += spill(largest - partitions_.cbegin());
+        }
+        count_spill(bytes);
+    }
+
+    // write the values of a partition to a sorted run and release them;
+    // returns the size of the file
+    uintmax_t const spill(size_t const partition)
+    {
+        partition_t &part = partitions_[partition];
+
+        std::string const filename = platform::get_temporary_filename();
+        part.fragment_filenames.push_back(filename);
+
+        detail::record_writer file(1 << 20, &codec_);
+        if (!file.open(filename))
+            BOOST_THROW_EXCEPTION(std::runtime_error("Unable to open file " + filename));
+
+        typename record_format_type::record_type record;
+        for (auto &kv : part.values)
+        {
+            // records are sorted by key and then value
+            std::sort(kv.second.begin(), kv.second.end());
+            record.first = kv.first;
+            for (auto const &value : kv.second)
+            {
+                record.second = value;
+                record_format_type::write(file, record);
+            }
+        }
+        file.close();
+        if (file.fail())
+            BOOST_THROW_EXCEPTION(std::runtime_error("An error occurred writing the file " + filename));
+
+        part.values.clear();
+        buffered_bytes_ -= part.bytes;
+        part.bytes = 0;
+
+        if (spill_counters_)
+            spill_counters_->partition_spilled(partition, file.file_bytes());
+        return file.file_bytes();
+    }
+
+    // a spill is counted only if it wrote something
+    void count_spill(uintmax_t const bytes)
+    {
+        if (spill_counters_  &&  bytes > 0)
+        {
+            ++spill_counters_->spills;
+            spill_counters_->spilled_bytes += bytes;
+        }
+    }
+
+  private:
+    size_t const             num_partitions_;
+    std::vector<partition_t> partitions_;
+    PartitionFn              partitioner_;
+    size_t                   memory_budget_;
+    std::atomic<size_t>      buffered_bytes_;    // estimated memory held by all partitions
+    detail::spill_counters  *spill_counters_;
+    detail::block_codec      codec_;
+    std::vector<keyvalue_t>  results_;           // always empty
+};
+
+}   // namespace intermediates
+
+}   // namespace mapreduce
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
@@ -3,10 +3,255 @@
 
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <type_traits>
+#include <vector>
 #include <boost/iterator/iterator_facade.hpp>
 
 namespace mapreduce {
 
+namespace detail {
+
+// The values of a key are given to a reduce function as a range of const
+// pointers wherever a store holds them contiguously, so that the function
+// reads an array, which the compiler can vectorise, rather than following
+// list nodes; see reducers.hpp.
+template<typename T, typename Alloc>
+T const *values_begin(std::vector<T, Alloc> const &values)
+{
+    return values.data();
+}
+
+template<typename T, typename Alloc>
+T const *values_end(std::vector<T, Alloc> const &values)
+{
+    return values.data() + values.size();
+}
+
+// The partitions of a k-way merge of sorted partitions, kept in a binary
+// heap so the partition with the first current key is found in O(log P)
+// rather than by a scan of every partition. before(left, right) is a strict
+// total order on partitions by their current keys, supplied on each call
+// because it depends on the position of the iterator that owns the heap.
+class partition_heap
+{
+  public:
+    void clear()
+    {
+        heap_.clear();
+    }
+
+    bool const empty() const
+    {
+        return heap_.empty();
+    }
+
+    size_t const top() const
+    {
+        return heap_.front();
+    }
+
+    template<typename Before>
+    void push(size_t const partition, Before const &before)
+    {
+        heap_.push_back(partition);
+        std::push_heap(heap_.begin(), heap_.end(), after(before));
+    }
+
+    // remove the top partition before it is moved past its current key,
+    // then push it again if it is not exhausted
+    template<typename Before>
+    void pop(Before const &before)
+    {
+        std::pop_heap(heap_.begin(), heap_.end(), after(before));
+        heap_.pop_back();
+    }
+
+  private:
+    // std:: heaps keep the largest element at the front, so order by "after"
+    template<typename Before>
+    struct after_t
+    {
+        Before const &before;
+
+        bool const operator()(size_t const left, size_t const right) const
+        {
+            return before(right, left);
+        }
+    };
+
+    template<typename Before>
+    static after_t<Before> after(Before const &before)
+    {
+        return after_t<Before>{before};
+    }
+
+  private:
+    std::vector<size_t> heap_;
+};
+
+// Integral keys in std::less order are grouped by a radix sort of flat
+// arrays of the keys and values rather than by a std::map, see in_memory.
+template<typename Key, typename KeyCompare>
+struct radix_groupable
+  : std::integral_constant<
+        bool,
+        std::is_integral<Key>::value
+    &&  !std::is_same<Key, bool>::value
+    &&  std::is_same<KeyCompare, std::less<Key>>::value>
+{
+};
+
+// Intermediate values of integral keys, kept as parallel arrays of keys and
+// values in the order they are inserted until group() sorts them by key.
+// The keys are sorted a byte at a time by a least significant digit radix
+// sort, which is stable and makes no key comparisons; a byte that every key
+// shares is skipped, so small keys in a wide type take few passes.
+template<typename Key, typename Value>
+class radix_records
+{
+  public:
+    void push_back(Key const &key, Value const &value)
+    {
+        keys_.push_back(key);
+        values_.push_back(value);
+    }
+
+    size_t const size() const
+    {
+        return keys_.size();
+    }
+
+    void clear()
+    {
+        keys_.clear();
+        values_.clear();
+        runs_.clear();
+    }
+
+    void swap(radix_records &other)
+    {
+        keys_.swap(other.keys_);
+        values_.swap(other.values_);
+        runs_.swap(other.runs_);
+    }
+
+    // move the records of other to the end of these
+    void append(radix_records &other)
+    {
+        if (keys_.empty())
+            swap(other);
+        else
+        {
+            keys_.insert(keys_.end(), other.keys_.cbegin(), other.keys_.cend());
+            values_.insert(values_.end(), other.values_.cbegin(), other.values_.cend());
+        }
+        other.clear();
+    }
+
+    // sort the records by key and find the run of values of each key;
+    // returns the number of keys. equal keys keep their insertion order
+    size_t const group()
+    {
+        if (keys_.size() > 1)
+            sort();
+
+        runs_.clear();
+        for (size_t index=0; index<keys_.size(); ++index)
+        {
+            if (index == 0  ||  keys_[index] != keys_[index-1])
+                runs_.push_back(index);
+        }
+        runs_.push_back(keys_.size());
+        return runs_.size() - 1;
+    }
+
+    // the key of a run found by group(), and its values
+    Key const &key(size_t const run) const
+    {
+        return keys_[runs_[run]];
+    }
+
+    Value const *values_begin(size_t const run) const
+    {
+        return values_.data() + runs_[run];
+    }
+
+    Value const *values_end(size_t const run) const
+    {
+        return values_.data() + runs_[run+1];
+    }
+
+  private:
+    // only named for the integral keys that are grouped
+    typedef
+    typename std::conditional<
+        radix_groupable<Key, std::less<Key>>::value,
+        std::make_unsigned<Key>,
+        std::common_type<size_t>>::type::type
+    bits_type;
+
+    // the key as unsigned bits in the same order; a signed key has its sign
+    // bit flipped so that negative keys come first
+    static bits_type const bits(Key const key)
+    {
+        return bits_type(key) ^ (std::is_signed<Key>::value? bits_type(bits_type(1) << (8*sizeof(Key)-1)) : bits_type(0));
+    }
+
+    static size_t const digit(Key const key, size_t const pass)
+    {
+        return size_t(bits(key) >> (8*pass)) & 0xff;
+    }
+
+    void sort()
+    {
+        size_t const count = keys_.size();
+
+        // the histograms of every byte, counted in one pass over the keys
+        std::vector<size_t> histograms(sizeof(Key) * 256, 0);
+        for (auto const key : keys_)
+        {
+            for (size_t pass=0; pass<sizeof(Key); ++pass)
+                ++histograms[pass*256 + digit(key, pass)];
+        }
+
+        std::vector<Key>   keys(count);
+        std::vector<Value> values(count);
+        for (size_t pass=0; pass<sizeof(Key); ++pass)
+        {
+            size_t *const offsets = &histograms[pass*256];
+            if (std::find(offsets, offsets+256, count) != offsets+256)
+                continue;
+
+            size_t offset = 0;
+            for (size_t loop=0; loop<256; ++loop)
+            {
+                size_t const n = offsets[loop];
+                offsets[loop] = offset;
+                offset += n;
+            }
+
+            for (size_t index=0; index<count; ++index)
+            {
+                size_t const to = offsets[digit(keys_[index], pass)]++;
+                keys[to]   = keys_[index];
+                values[to] = std::move(values_[index]);
+            }
+            keys_.swap(keys);
+            values_.swap(values);
+        }
+    }
+
+  private:
+    std::vector<Key>    keys_;
+    std::vector<Value>  values_;
+    std::vector<size_t> runs_;      // first record of each key, and the end
+};
+
+}   // namespace detail
+
 namespace intermediates {
 
 template<typename ReduceKeyType, typename MapValueType>
@@ -42,14 +287,61 @@ class reduce_null_output
     }
 };
 
+// A StoreResult that writes each reduce result to element [key] of a dense
+// array owned by the caller, given to the job with job::result_target. The
+// results are not inserted back into the intermediate store, so the job's
+// result iterators are empty. Keys must index the array.
+template<typename MapTask, typename ReduceTask>
+class dense_array_output
+{
+  public:
+    typedef std::vector<typename ReduceTask::value_type> target_type;
+
+    dense_array_output(std::string const &/*output_filespec*/,
+                       size_t      const  /*partition*/,
+                       size_t      const  /*num_partitions*/)
+      : target_(0)
+    {
+    }
+
+    void target(target_type &target)
+    {
+        target_ = &target;
+    }
+
+    bool const operator()(typename ReduceTask::key_type   const &key,
+                          typename ReduceTask::value_type const &value)
+    {
+        assert(target_  &&  size_t(key) < target_->size());
+        (*target_)[key] = value;
+        return true;
+    }
+
+  private:
+    target_type *target_;
+};
 
+// Intermediate values are grouped by key in a std::map for each partition.
+// An integral key in std::less order, see detail::radix_groupable, instead
+// has its values buffered in flat arrays as the map task emits them, and
+// grouped by a radix sort when the partition is combined or reduced, so the
+// map phase makes no key comparisons. The final results are kept in the
+// std::map in either case, one value per key. With radix grouping a
+// combiner cannot fold values as they are inserted, so it runs after the
+// map task as it does for other stores.
+//
+// The std::map of each partition, and its vectors of values, allocate with
+// Allocator. With the default, arena_allocator, each partition of each
+// store has an arena that is freed in one step once the partition has been
+// reduced, combined or merged into another store.
 template<
     typename MapTask,
     typename ReduceTask,
     typename KeyType     = typename ReduceTask::key_type,
     typename PartitionFn = mapreduce::hash_partitioner,
     typename KeyCompare  = std::less<typename ReduceTask::key_type>,
-    typename StoreResult = reduce_null_output<MapTask, ReduceTask>
+    typename StoreResult = reduce_null_output<MapTask, ReduceTask>,
+    typename Allocator   = default_store_allocator
 >
 class in_memory : detail::noncopyable
 {
@@ -61,11 +353,28 @@ class in_memory : detail::noncopyable
     typedef StoreResult                     store_result_type;
 
   private:
+    typedef std::allocator_traits<Allocator>                         allocator_traits;
+    typedef typename detail::store_arena<Allocator>::type            arena_type;
+    typedef std::unique_ptr<arena_type>                              arena_ptr;
+    typedef
+    std::vector<value_type, typename allocator_traits::template rebind_alloc<value_type>>
+    values_t;
+
+    typedef
+    std::map<
+        KeyType, values_t, KeyCompare,
+        typename allocator_traits::template rebind_alloc<std::pair<KeyType const, values_t>>>
+    map_type;
+
+    typedef std::vector<map_type> intermediates_t;
+
     typedef
-    std::vector<
-        std::map<
-            KeyType, std::list<value_type>,KeyCompare>>
-    intermediates_t;
+    std::integral_constant<bool, detail::radix_groupable<KeyType, KeyCompare>::value>
+    radix_grouping;
+
+    typedef
+    std::vector<detail::radix_records<KeyType, value_type>>
+    records_t;
 
   public:
     typedef
@@ -84,8 +393,11 @@ class in_memory : detail::noncopyable
         const_result_iterator(const_result_iterator const &) = default;
 
       private:
-        explicit const_result_iterator(in_memory const *outer)
-          : outer_(outer)
+        // ordered iterates the results in KeyCompare order, merging the
+        // partitions; otherwise one partition follows another
+        const_result_iterator(in_memory const *outer, bool const ordered)
+          : outer_(outer),
+            ordered_(ordered)
         {
             assert(outer_);
             iterators_.resize(outer_->num_partitions_);
@@ -98,8 +410,13 @@ class in_memory : detail::noncopyable
             ++current_.second;
             if (current_.second == iterators_[current_.first]->second.end())
             {
-                if (iterators_[current_.first] != outer_->intermediates_[current_.first].end())
-                    ++iterators_[current_.first];
+                size_t const partition = current_.first;
+                if (ordered_)
+                    heap_.pop(before());
+
+                ++iterators_[partition];
+                if (ordered_  &&  !exhausted(partition))
+                    heap_.push(partition, before());
 
                 set_current();
             }
@@ -116,8 +433,14 @@ class in_memory : detail::noncopyable
 
         const_result_iterator &begin()
         {
+            heap_.clear();
             for (size_t loop=0; loop<outer_->num_partitions_; ++loop)
+            {
                 iterators_[loop] = outer_->intermediates_[loop].cbegin();
+                if (ordered_  &&  !exhausted(loop))
+                    heap_.push(loop, before());
+            }
+            current_.first = 0;
             set_current();
             return *this;
         }
@@ -127,6 +450,7 @@ class in_memory : detail::noncopyable
             current_.first = std::numeric_limits<decltype(current_.first)>::max();
             value_ = keyvalue_t();
             iterators_.clear();
+            heap_.clear();
             return *this;
         }
 
@@ -135,17 +459,37 @@ class in_memory : detail::noncopyable
             return value_;
         }
 
+        bool const exhausted(size_t const partition) const
+        {
+            return iterators_[partition] == outer_->intermediates_[partition].end();
+        }
+
+        // partitions by current key, equal keys from the lowest partition first
+        struct before_t
+        {
+            const_result_iterator const *it;
+
+            bool const operator()(size_t const left, size_t const right) const
+            {
+                KeyCompare const compare;
+                return compare(it->iterators_[left]->first, it->iterators_[right]->first)
+                   ||  (!compare(it->iterators_[right]->first, it->iterators_[left]->first)  &&  left < right);
+            }
+        };
+
+        before_t before() const
+        {
+            return before_t{this};
+        }
+
         void set_current()
         {
-            for (current_.first=0;
-                 current_.first<outer_->num_partitions_  &&  iterators_[current_.first] == outer_->intermediates_[current_.first].end();
-                 ++current_.first)
-            { }
-            
-            for (auto loop=current_.first+1; loop<outer_->num_partitions_; ++loop)
+            if (ordered_)
+                current_.first = heap_.empty()? outer_->num_partitions_ : heap_.top();
+            else
             {
-                if (iterators_[loop] != outer_->intermediates_[loop].end()  &&  *iterators_[current_.first] > *iterators_[loop])
-                    current_.first = loop;
+                while (current_.first<outer_->num_partitions_  &&  exhausted(current_.first))
+                    ++current_.first;
             }
 
             if (current_.first == outer_->num_partitions_)
@@ -168,9 +512,11 @@ class in_memory : detail::noncopyable
             typename intermediates_t::value_type::mapped_type::const_iterator>
         current_t;
 
-        keyvalue_t       value_;        // value of current element
-        iterators_t      iterators_;    // iterator group
-        in_memory const *outer_;        // parent container
+        keyvalue_t              value_;     // value of current element
+        iterators_t             iterators_; // iterator group
+        in_memory const        *outer_;     // parent container
+        bool                    ordered_;   // merge the partitions in key order
+        detail::partition_heap  heap_;      // partitions not yet exhausted, if ordered_
 
         // the current element consists of an index to the partition
         // list, and an iterator within that list
@@ -185,24 +531,65 @@ class in_memory : detail::noncopyable
     friend class const_result_iterator;
 
     explicit in_memory(size_t const num_partitions=1)
-      : num_partitions_(num_partitions)
+      : num_partitions_(num_partitions),
+        arena_counters_(0)
     {
+        arenas_.resize(num_partitions_);
         intermediates_.resize(num_partitions_);
+        records_.resize(num_partitions_);
+        for (size_t partition=0; partition<num_partitions_; ++partition)
+            new_arena(partition);
+    }
+
+    // called by the job to count the allocations of the arenas
+    void arena_counters(detail::arena_counters *counters)
+    {
+        arena_counters_ = counters;
+        for (auto &arena : arenas_)
+            arena->counters(counters);
+    }
+
+    // add the allocations of the arenas still in use to the counters
+    void report_arenas()
+    {
+        for (auto &arena : arenas_)
+            arena->report();
+    }
+
+    // called by the job, see job::partitioner
+    void partitioner(PartitionFn const &fn)
+    {
+        partitioner_ = fn;
     }
 
     const_result_iterator begin_results() const
     {
-        return const_result_iterator(this).begin();
+        return const_result_iterator(this, true).begin();
     }
 
     const_result_iterator end_results() const
     {
-        return const_result_iterator(this).end();
+        return const_result_iterator(this, true).end();
+    }
+
+    // the results in no particular order, partition by partition, without
+    // the cost of merging the partitions
+    const_result_iterator begin_unordered_results() const
+    {
+        return const_result_iterator(this, false).begin();
+    }
+
+    const_result_iterator end_unordered_results() const
+    {
+        return const_result_iterator(this, false).end();
     }
 
     void swap(in_memory &other)
     {
+        using std::swap;
         swap(intermediates_, other.intermediates_);
+        swap(arenas_, other.arenas_);
+        swap(records_, other.records_);
     }
 
     void run_intermediate_results_shuffle(size_t const /*partition*/)
@@ -212,25 +599,68 @@ class in_memory : detail::noncopyable
     template<typename Callback>
     void reduce(size_t const partition, Callback &callback)
     {
-        typename intermediates_t::value_type map;
-        using std::swap;
-        swap(map, intermediates_[partition]);
+        reduce(partition, callback, radix_grouping());
+    }
 
-        for (auto const &result : map)
-            callback(result.first, result.second.cbegin(), result.second.cend());
+    // with radix grouping the keys are not counted until the partition is
+    // grouped, so this is the number of values, an upper bound
+    size_t const partition_key_count(size_t const partition) const
+    {
+        return radix_grouping::value? records_[partition].size() : intermediates_[partition].size();
+    }
+
+    // detach the values of a partition and divide its keys into at most
+    // `pieces` ranges, each reduced by reduce(partition, piece, callback)
+    size_t const split_partition(size_t const partition, size_t const pieces)
+    {
+        if (!splits_)
+            splits_.reset(new split_t[num_partitions_]);
+
+        split_t &split = splits_[partition];
+        size_t const count = split_partition(split, partition, pieces, radix_grouping());
+        split.remaining = count;
+        return count;
+    }
+
+    template<typename Callback>
+    void reduce(size_t const partition, size_t const piece, Callback &callback)
+    {
+        split_t &split = splits_[partition];
+        if (radix_grouping::value)
+        {
+            for (size_t run=split.runs[piece]; run<split.runs[piece+1]; ++run)
+                callback(split.records.key(run), split.records.values_begin(run), split.records.values_end(run));
+        }
+        else
+        {
+            for (auto it=split.bounds[piece]; it!=split.bounds[piece+1]; ++it)
+                callback(it->first, detail::values_begin(it->second), detail::values_end(it->second));
+        }
+
+        // the last piece to finish releases the partition's values
+        if (--split.remaining == 0)
+        {
+            split.bounds.clear();
+            split.map.clear();
+            split.arena.reset();
+            split.runs.clear();
+            split.records.clear();
+        }
     }
 
     void merge_from(size_t partition, in_memory &other)
     {
-        typedef typename intermediates_t::value_type map_type;
+        records_[partition].append(other.records_[partition]);
 
         map_type &map       = intermediates_[partition];
         map_type &other_map = other.intermediates_[partition];
 
+        // the values move with the arena that holds them
         if (map.size() == 0)
         {
             using std::swap;
             swap(map, other_map);
+            swap(arenas_[partition], other.arenas_[partition]);
             return;
         }
 
@@ -240,13 +670,14 @@ class in_memory : detail::noncopyable
                 map.insert(
                     std::make_pair(
                         result.first,
-                        typename map_type::mapped_type())).first;
+                        new_values(map))).first;
 
             std::copy(
                 result.second.cbegin(),
                 result.second.cend(),
                 std::back_inserter(iti->second));
         }
+        other.new_arena(partition);
     }
 
     void merge_from(in_memory &other)
@@ -267,32 +698,207 @@ class in_memory : detail::noncopyable
                       typename reduce_task_type::value_type const &value,
                       StoreResult &store_result)
     {
-        return store_result(key, value)  &&  insert(key, value);
+        return store_result(key, value)  &&  insert(partition_of(key), key, value, std::false_type());
     }
 
     // receive intermediate result
     bool const insert(key_type                     const &key,
                       typename reduce_task_type::value_type const &value)
     {
-        size_t const  partition = (num_partitions_ == 1)? 0 : partitioner_(key, num_partitions_);
+        return insert(partition_of(key), key, value, radix_grouping());
+    }
+
+    // receive intermediate result for a given partition, whichever partition
+    // the partitioner would choose, see job::combine_partition
+    bool const insert(size_t                                const  partition,
+                      key_type                              const &key,
+                      typename reduce_task_type::value_type const &value)
+    {
+        return insert(partition, key, value, radix_grouping());
+    }
+
+    // not available with radix grouping, see the class comment
+    template<typename T, typename Combiner, typename Radix=radix_grouping>
+    typename std::enable_if<!Radix::value, bool const>::type
+    insert_combined(T const &key, typename reduce_task_type::value_type const &value, Combiner const &combiner)
+    {
+        return insert_combined(make_intermediate_key<key_type>(key), value, combiner);
+    }
+
+    // receive intermediate result, folding it into the value already held
+    // for the key, see detail::can_combine_on_insert
+    template<typename Combiner, typename Radix=radix_grouping>
+    typename std::enable_if<!Radix::value, bool const>::type
+    insert_combined(key_type                              const &key,
+                    typename reduce_task_type::value_type const &value,
+                    Combiner                              const &combiner)
+    {
+        size_t const  partition = partition_of(key);
         auto         &map       = intermediates_[partition];
+        auto         &values    = map.insert(std::make_pair(key, new_values(map))).first->second;
+        if (values.empty())
+        {
+            values.push_back(value);
+            return false;
+        }
+
+        combiner.fold(values.front(), value);
+        return true;
+    }
 
-        typedef typename intermediates_t::value_type::mapped_type mapped_type;
+    template<typename FnObj>
+    void combine(FnObj &fn_obj)
+    {
+        combine(fn_obj, radix_grouping());
+    }
+
+    void combine(null_combiner &)
+    {
+    }
+
+  private:
+    size_t const partition_of(key_type const &key) const
+    {
+        return (num_partitions_ == 1)? 0 : partitioner_(key, num_partitions_);
+    }
+
+    // an empty vector of values that allocates from the arena of map
+    static values_t new_values(map_type const &map)
+    {
+        return values_t(typename values_t::allocator_type(map.get_allocator()));
+    }
+
+    // give a partition a new arena and an empty std::map that allocates from
+    // it. the old values are destroyed before their arena is
+    void new_arena(size_t const partition)
+    {
+        arena_ptr arena(new arena_type(arena_counters_));
+        intermediates_[partition] =
+            map_type(
+                KeyCompare(),
+                typename map_type::allocator_type(detail::store_arena<Allocator>::allocator(*arena)));
+        arenas_[partition] = std::move(arena);
+    }
+
+    // move the values of a partition, and the arena that holds them, out of
+    // the store, leaving the partition empty with a new arena
+    void detach(size_t const partition, map_type &map, arena_ptr &arena)
+    {
+        map   = std::move(intermediates_[partition]);
+        arena = std::move(arenas_[partition]);
+        new_arena(partition);
+    }
+
+    // buffer the value of an integral key, to be grouped by radix sort
+    bool const insert(size_t                                const  partition,
+                      key_type                              const &key,
+                      typename reduce_task_type::value_type const &value,
+                      std::true_type)
+    {
+        records_[partition].push_back(key, value);
+        return true;
+    }
+
+    bool const insert(size_t                                const  partition,
+                      key_type                              const &key,
+                      typename reduce_task_type::value_type const &value,
+                      std::false_type)
+    {
+        auto &map = intermediates_[partition];
         map.insert(
             std::make_pair(
                 key,
-                mapped_type())).first->second.push_back(value);
+                new_values(map))).first->second.push_back(value);
 
         return true;
     }
 
+    template<typename Callback>
+    void reduce(size_t const partition, Callback &callback, std::true_type)
+    {
+        detail::radix_records<KeyType, value_type> records;
+        records.swap(records_[partition]);
+        new_arena(partition);
+
+        size_t const keys = records.group();
+        for (size_t run=0; run<keys; ++run)
+            callback(records.key(run), records.values_begin(run), records.values_end(run));
+    }
+
+    template<typename Callback>
+    void reduce(size_t const partition, Callback &callback, std::false_type)
+    {
+        // the arena is destroyed after the values in it
+        arena_ptr arena;
+        map_type  map;
+        detach(partition, map, arena);
+
+        for (auto const &result : map)
+            callback(result.first, detail::values_begin(result.second), detail::values_end(result.second));
+    }
+
+    struct split_t;
+
+    size_t const split_partition(split_t &split, size_t const partition, size_t const pieces, std::true_type)
+    {
+        split.runs.clear();
+        split.records.clear();
+        split.records.swap(records_[partition]);
+        new_arena(partition);
+
+        size_t const keys  = split.records.group();
+        size_t const count = std::max<size_t>(1, std::min(pieces, keys));
+        for (size_t piece=0; piece<=count; ++piece)
+            split.runs.push_back(keys*piece/count);
+        return count;
+    }
+
+    size_t const split_partition(split_t &split, size_t const partition, size_t const pieces, std::false_type)
+    {
+        split.bounds.clear();
+        split.map.clear();
+        detach(partition, split.map, split.arena);
+
+        size_t const keys  = split.map.size();
+        size_t const count = std::max<size_t>(1, std::min(pieces, keys));
+        auto it = split.map.cbegin();
+        for (size_t piece=0; piece<count; ++piece)
+        {
+            split.bounds.push_back(it);
+            std::advance(it, keys*(piece+1)/count - keys*piece/count);
+        }
+        split.bounds.push_back(split.map.cend());
+        return count;
+    }
+
     template<typename FnObj>
-    void combine(FnObj &fn_obj)
+    void combine(FnObj &fn_obj, std::true_type)
     {
-        intermediates_t intermediates;
-        intermediates.resize(num_partitions_);
+        records_t records(num_partitions_);
         using std::swap;
-        swap(intermediates_, intermediates);
+        swap(records_, records);
+
+        for (auto &partition : records)
+        {
+            size_t const keys = partition.group();
+            for (size_t run=0; run<keys; ++run)
+            {
+                fn_obj.start(partition.key(run));
+                for (auto value=partition.values_begin(run); value!=partition.values_end(run); ++value)
+                    fn_obj(*value);
+                fn_obj.finish(partition.key(run), *this);
+            }
+        }
+    }
+
+    template<typename FnObj>
+    void combine(FnObj &fn_obj, std::false_type)
+    {
+        // the combined values are inserted into new arenas
+        std::vector<arena_ptr> arenas(num_partitions_);
+        intermediates_t        intermediates(num_partitions_);
+        for (size_t partition=0; partition<num_partitions_; ++partition)
+            detach(partition, intermediates[partition], arenas[partition]);
 
         for (auto const &intermediate : intermediates)
         {
@@ -306,14 +912,26 @@ class in_memory : detail::noncopyable
         }
     }
 
-    void combine(null_combiner &)
+    // a partition detached by split_partition: a std::map and iterators to
+    // the first key of each piece, or grouped records and the first run of
+    // each piece
+    struct split_t
     {
-    }
+        arena_ptr                                        arena;
+        map_type                                         map;
+        std::vector<typename map_type::const_iterator>   bounds;
+        detail::radix_records<KeyType, value_type>       records;
+        std::vector<size_t>                              runs;
+        std::atomic<size_t>                              remaining;
+    };
 
-  private:
-    size_t const    num_partitions_;
-    intermediates_t intermediates_;
-    PartitionFn     partitioner_;
+    size_t const               num_partitions_;
+    std::vector<arena_ptr>     arenas_;         // of each partition, destroyed after the values in it
+    intermediates_t            intermediates_;
+    records_t                  records_;        // values of keys grouped by radix sort
+    PartitionFn                partitioner_;
+    std::unique_ptr<split_t[]> splits_;     // partitions detached by split_partition
+    detail::arena_counters    *arena_counters_;
 };
 
 
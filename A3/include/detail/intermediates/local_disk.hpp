@@ -5,6 +5,7 @@
 
 #include <iomanip>      // setw
 #include "../job.hpp"
+#include "records.hpp"
 #ifdef __GNUC__
 #include <iostream>     // ubuntu linux
 #include <fstream>      // ubuntu linux
@@ -16,137 +17,6 @@ struct null_combiner;
 
 namespace detail {
 
-struct file_lines_comp
-{
-    template<typename T>
-    bool const operator()(T const &first, T const &second)
-    {
-        return first.second < second.second;
-    }
-};
-
-template<typename Record>
-struct file_merger
-{
-    template<typename List>
-    void operator()(List const &filenames, std::string const &dest)
-    {
-        std::copy(filenames.cbegin(), filenames.cend(), std::back_inserter(files));
-        std::copy(filenames.cbegin(), filenames.cend(), std::back_inserter(delete_files));
-
-        outfile.open(dest.c_str(), std::ios_base::out | std::ios_base::binary);
-        while (files.size() > 0)
-        {
-            open_files();
-            merge_files(dest);
-
-            assert(file_lines.size() == 0);
-
-            // subsequent merges need to merge with outfile from previous
-            // iteration. to do this, rename the output file to a temporary
-            // filename and add it to the list of files to merge, then re-open
-            // the destination file
-            if (files.size() > 0)
-                rename_result_for_iterative_merge(dest);
-        }
-    }
-
-  private:
-    struct file_deleter : private std::vector<std::string>
-    {
-        ~file_deleter()
-        {
-            for (auto const &filename : *this)
-                detail::delete_file(filename);
-        }
-
-        // enable std::back_inserter
-        using std::vector<std::string>::push_back;
-        using std::vector<std::string>::value_type;
-        using std::vector<std::string>::const_reference;
-    };
-
-    void open_files()
-    {
-        // open each file and read the first record (line) from each
-        while (files.size() > 0)
-        {
-            auto file = std::make_shared<std::ifstream>(files.front().c_str(), std::ios_base::in | std::ios_base::binary);
-            if (!file->is_open())
-                break;
-
-            files.pop_front();
-
-            std::string line;
-            std::getline(*file, line, '\r');
-
-            Record record;
-            std::istringstream l(line);
-            l >> record;
-            file_lines.push_back(std::make_pair(file, record));
-        }
-    }
-
-    void merge_files(std::string const &dest)
-    {
-        // find the smallest record in the list
-        while (file_lines.size() > 0)
-        {
-            auto it = std::min_element(file_lines.begin(), file_lines.end(), file_lines_comp());
-
-            // scan for all occurrences of the smallest record in our list of records,
-            // and write each one to the output files
-            Record const record = it->second;
-            while (it != file_lines.end())
-            {
-                if (it->second == record)
-                {
-                    outfile << it->second << "\r";
-
-                    std::string line;
-                    std::getline(*it->first, line, '\r');
-
-                    if (length(line) > 0)
-                    {
-                        std::istringstream l(line);
-                        l >> it->second;
-                    }
-
-                    if (it->first->eof())
-                    {
-                        auto it1 = it++;
-                        file_lines.erase(it1);
-                    }
-                    else
-                        ++it;
-                }
-                else
-                    ++it;
-            }
-        }
-    }
-
-    void rename_result_for_iterative_merge(std::string const &dest)
-    {
-        outfile.close();
-
-        std::string const temp_filename = platform::get_temporary_filename();
-        delete_file(temp_filename);
-        boost::filesystem::rename(dest, temp_filename);
-        delete_files.push_back(temp_filename);
-
-        files.push_back(temp_filename);
-        outfile.open(dest.c_str(), std::ios_base::out | std::ios_base::binary);
-    }
-
-  private:
-    typedef std::list<std::pair<std::shared_ptr<std::ifstream>, Record> > file_lines_t;
-    file_lines_t           file_lines;
-    std::list<std::string> files;
-    std::ofstream          outfile;
-    file_deleter           delete_files;
-};
-
 template<typename Record>
 struct file_key_combiner
 {
@@ -210,14 +80,24 @@ struct key_combiner : public T
 };
 
 
+// Intermediate values are buffered in memory, sorted, until the buffers of
+// all partitions reach the store's memory budget, its share of
+// specification::spill_memory_budget (see job::map_store_budget), or the
+// map task's output is combined. Each partition's buffer is then written to
+// a sorted run file in RecordFormat: binary_records by default, or
+// text_records for files that can be read when debugging, and compressed
+// if specification::spill_compression is set. The runs of a
+// partition are merged by MergeFn in the shuffle; the default
+// detail::file_merger takes its fan-in and read buffer size as template
+// arguments.
 template<
     typename MapTask,
     typename ReduceTask,
     typename KeyType         = typename ReduceTask::key_type,
     typename PartitionFn     = hash_partitioner,
     typename StoreResultType = reduce_file_output<MapTask, ReduceTask>,
-    typename CombineFile     = detail::file_key_combiner<key_combiner<std::pair<typename ReduceTask::key_type, typename ReduceTask::value_type>>>,
-    typename MergeFn         = detail::file_merger<std::pair<typename ReduceTask::key_type, typename ReduceTask::value_type> > >
+    typename RecordFormat    = binary_records<typename ReduceTask::key_type, typename ReduceTask::value_type>,
+    typename MergeFn         = detail::file_merger<RecordFormat> >
 class local_disk : detail::noncopyable
 {
   public:
@@ -225,6 +105,7 @@ class local_disk : detail::noncopyable
     typedef ReduceTask      reduce_task_type;
     typedef KeyType         key_type;
     typedef StoreResultType store_result_type;
+    typedef RecordFormat    record_format_type;
 
     typedef
     std::pair<
@@ -241,8 +122,11 @@ class local_disk : detail::noncopyable
         friend class boost::iterator_core_access;
 
       protected:
-        explicit const_result_iterator(local_disk const *outer)
-          : outer_(outer)
+        // ordered iterates the results in key order, merging the partition
+        // files; otherwise one file follows another
+        const_result_iterator(local_disk const *outer, bool const ordered)
+          : outer_(outer),
+            ordered_(ordered)
         {
             assert(outer_);
             kvlist_.resize(outer_->num_partitions_);
@@ -250,8 +134,13 @@ class local_disk : detail::noncopyable
 
         void increment()
         {
-            if (!kvlist_[index_].first->eof())
-                read_record(*kvlist_[index_].first, kvlist_[index_].second.first, kvlist_[index_].second.second);
+            size_t const partition = index_;
+            if (ordered_)
+                heap_.pop(before());
+
+            read_next(partition);
+            if (ordered_  &&  !exhausted(partition))
+                heap_.push(partition, before());
             set_current();
         }
 
@@ -265,25 +154,27 @@ class local_disk : detail::noncopyable
 
         const_result_iterator &begin()
         {
+            heap_.clear();
             for (size_t loop=0; loop<outer_->num_partitions_; ++loop)
             {
-                auto intermediate = outer_->intermediate_files_.find(loop);
-                if (intermediate == outer_->intermediate_files_.end())
-                    return end();
+                // a partition that has been reduced, or that no key was
+                // partitioned to, has no file
+                std::string const &filename = outer_->intermediate_files_[loop].filename;
+                if (filename.empty())
+                    continue;
 
                 kvlist_[loop] =
                     std::make_pair(
-                        std::make_shared<std::ifstream>(
-                            intermediate->second->filename.c_str(),
-                            std::ios_base::binary),
+                        std::make_shared<detail::record_reader>(filename, 1 << 20, false, &outer_->codec_),
                         keyvalue_t());
 
                 assert(kvlist_[loop].first->is_open());
-                read_record(
-                    *kvlist_[loop].first,
-                    kvlist_[loop].second.first,
-                    kvlist_[loop].second.second);
+                read_next(loop);
+
+                if (ordered_  &&  !exhausted(loop))
+                    heap_.push(loop, before());
             }
+            index_ = 0;
             set_current();
             return *this;
         }
@@ -292,6 +183,7 @@ class local_disk : detail::noncopyable
         {
             index_ = 0;
             kvlist_.clear();
+            heap_.clear();
             return *this;
         }
 
@@ -300,16 +192,44 @@ class local_disk : detail::noncopyable
             return kvlist_[index_].second;
         }
 
+        bool const exhausted(size_t const partition) const
+        {
+            return !kvlist_[partition].first;
+        }
+
+        // the reader of a partition is released after its last record
+        void read_next(size_t const partition)
+        {
+            if (!exhausted(partition)  &&  !record_format_type::read(*kvlist_[partition].first, kvlist_[partition].second))
+                kvlist_[partition].first.reset();
+        }
+
+        // partitions by current record, equal records from the lowest
+        // partition first
+        struct before_t
+        {
+            const_result_iterator const *it;
+
+            bool const operator()(size_t const left, size_t const right) const
+            {
+                return it->kvlist_[left].second < it->kvlist_[right].second
+                   ||  (!(it->kvlist_[right].second < it->kvlist_[left].second)  &&  left < right);
+            }
+        };
+
+        before_t before() const
+        {
+            return before_t{this};
+        }
+
         void set_current()
         {
-            index_ = 0;
-            while (index_<outer_->num_partitions_  &&  kvlist_[index_].first->eof())
-                 ++index_;
-            
-            for (size_t loop=index_+1; loop<outer_->num_partitions_; ++loop)
+            if (ordered_)
+                index_ = heap_.empty()? outer_->num_partitions_ : heap_.top();
+            else
             {
-                if (!kvlist_[loop].first->eof()  &&  !kvlist_[index_].first->eof()  &&  kvlist_[index_].second > kvlist_[loop].second)
-                    index_ = loop;
+                while (index_<outer_->num_partitions_  &&  exhausted(index_))
+                     ++index_;
             }
 
             if (index_ == outer_->num_partitions_)
@@ -318,11 +238,13 @@ class local_disk : detail::noncopyable
 
       private:
         local_disk                    const *outer_;        // parent container
+        bool                                 ordered_;      // merge the partitions in key order
+        detail::partition_heap               heap_;         // partitions not yet exhausted, if ordered_
         size_t                               index_ = 0;    // index of current element
         typedef
         std::vector<
             std::pair<
-                std::shared_ptr<std::ifstream>,
+                std::shared_ptr<detail::record_reader>,
                 keyvalue_t> >
         kvlist_t;
         kvlist_t kvlist_;
@@ -332,114 +254,83 @@ class local_disk : detail::noncopyable
     friend class const_result_iterator;
 
   private:
-    struct intermediate_file_info
+    // records of one partition not yet written to a run, each distinct
+    // record held once with its number of occurrences
+    class run_buffer
     {
-        intermediate_file_info() = default;
+      public:
+        typedef typename record_format_type::record_type record_t;
+        typedef std::map<record_t, size_t>               records_t;
 
-        explicit intermediate_file_info(std::string const& fname)
-          : filename(fname)
+        // returns the estimated bytes of memory added
+        size_t const insert(typename ReduceTask::key_type   const &key,
+                            typename ReduceTask::value_type const &value)
         {
+            auto const inserted = records_.insert(std::make_pair(record_t(key, value), size_t(0)));
+            ++inserted.first->second;
+            if (!inserted.second)
+                return 0;
+
+            // the map node is the value and three pointers and a colour
+            return sizeof(typename records_t::value_type)
+                 + 4 * sizeof(void *)
+                 + detail::dynamic_size(inserted.first->first);
         }
 
-        struct kv_file : public std::ofstream
+        bool const empty() const
         {
-            typedef typename MapTask::value_type    key_type;
-            typedef typename ReduceTask::value_type value_type;
-
-            kv_file() = default;
-
-            ~kv_file()
-            {
-                close();
-            }
-
-            void open(std::string const &filename)
-            {
-                assert(records_.empty());
-                use_cache_ = true;
-                std::ofstream::open(filename.c_str(), std::ios_base::binary);
-            }
-
-            void close()
-            {
-                if (is_open())
-                {
-                    flush_cache();
-                    std::ofstream::close();
-                }
-            }
-
-            bool const sorted(void) const
-            {
-                return sorted_;
-            }
-
-            bool const write(key_type const &key, value_type const &value)
-            {
-                if (use_cache_)
-                {
-                    ++records_.insert(std::make_pair(std::make_pair(key,value),0U)).first->second;
-                    return true;
-                }
-
-                sorted_ = false;
-                return write(key, value, 1);
-            }
+            return records_.empty();
+        }
 
-          protected:
-            bool const write(key_type   const &key,
-                             value_type const &value,
-                             size_t     const count)
-            {
-                std::ostringstream linebuf;
-                linebuf << std::make_pair(key,value);
+        records_t &records()
+        {
+            return records_;
+        }
 
-                std::string line(linebuf.str());
-                for (size_t loop=0; loop<count; ++loop)
-                {
-                    *this << line << "\r";
-                    if (fail())
-                        return false;
-                }
-                return true;
-            }
+        // write the records to a sorted run and clear the buffer; returns
+        // the size of the file
+        uintmax_t const write(std::string const &filename, detail::block_codec const &codec)
+        {
+            detail::record_writer file(1 << 20, &codec);
+            if (!file.open(filename))
+                BOOST_THROW_EXCEPTION(std::runtime_error("Unable to open file " + filename));
 
-            bool const flush_cache()
+            for (auto const &record : records_)
             {
-                use_cache_ = false;
-                for (auto it  = records_.cbegin(); it != records_.cend(); ++it)
-                {
-                    if (!write(it->first.first, it->first.second, it->second))
-                        return false;
-                }
-
-                records_.clear();
-                return true;
+                for (size_t loop=0; loop<record.second; ++loop)
+                    record_format_type::write(file, record.first);
             }
+            file.close();
+            if (file.fail())
+                BOOST_THROW_EXCEPTION(std::runtime_error("An error occurred writing the file " + filename));
 
-          private:
-            using record_t  = std::pair<key_type, value_type>;
-            using records_t = std::map<record_t, size_t>;
+            records_.clear();
+            return file.file_bytes();
+        }
 
-            bool      sorted_    = true;
-            bool      use_cache_ = true;
-            records_t records_;
-        };
+      private:
+        records_t records_;
+    };
 
-        std::string             filename;
-        kv_file                 write_stream;
-        std::list<std::string>  fragment_filenames;
+    struct intermediate_file_info
+    {
+        std::string             filename;               // the merged runs, after the shuffle
+        run_buffer              buffer;
+        std::list<std::string>  fragment_filenames;     // sorted runs
     };
 
-    typedef
-    std::map<
-        size_t, // hash value of intermediate key (R)
-        std::shared_ptr<intermediate_file_info> >
-    intermediates_t;
+    // indexed by partition. every partition has an entry from the start,
+    // and entries are cleared rather than erased, so threads working on
+    // different partitions never change the container
+    typedef std::vector<intermediate_file_info> intermediates_t;
 
   public:
     explicit local_disk(size_t const num_partitions)
-      : num_partitions_(num_partitions)
+      : num_partitions_(num_partitions),
+        intermediate_files_(num_partitions),
+        memory_budget_(0),
+        buffered_bytes_(0),
+        spill_counters_(0)
     {
     }
 
@@ -447,18 +338,13 @@ class local_disk : detail::noncopyable
     {
         try
         {
-            this->close_files();
-
             // delete the temporary files
-            for (auto it=intermediate_files_.cbegin();
-                 it!=intermediate_files_.cend();
-                 ++it)
+            for (auto const &fileinfo : intermediate_files_)
             {
-                intermediate_file_info const * const fileinfo = it->second.get();
-                detail::delete_file(fileinfo->filename);
+                detail::delete_file(fileinfo.filename);
                 for_each(
-                    fileinfo->fragment_filenames.cbegin(),
-                    fileinfo->fragment_filenames.cend(),
+                    fileinfo.fragment_filenames.cbegin(),
+                    fileinfo.fragment_filenames.cend(),
                     std::bind(detail::delete_file, std::placeholders::_1));
             }
         }
@@ -468,14 +354,40 @@ class local_disk : detail::noncopyable
         }
     }
 
+    // called by the job, see detail::has_configure_spill. without a budget
+    // the buffers are only written when the map output is combined
+    void configure_spill(detail::spill_settings const &settings)
+    {
+        memory_budget_  = settings.memory_budget;
+        spill_counters_ = settings.counters;
+        codec_          = detail::block_codec(settings.codec, settings.counters);
+    }
+
+    // called by the job, see job::partitioner
+    void partitioner(PartitionFn const &fn)
+    {
+        partitioner_ = fn;
+    }
+
     const_result_iterator begin_results() const
     {
-        return const_result_iterator(this).begin();
+        return const_result_iterator(this, true).begin();
     }
 
     const_result_iterator end_results() const
     {
-        return const_result_iterator(this).end();
+        return const_result_iterator(this, true).end();
+    }
+
+    // the results file by file, without merging the partitions
+    const_result_iterator begin_unordered_results() const
+    {
+        return const_result_iterator(this, false).begin();
+    }
+
+    const_result_iterator end_unordered_results() const
+    {
+        return const_result_iterator(this, false).end();
     }
 
     // receive final result
@@ -494,78 +406,68 @@ class local_disk : detail::noncopyable
     {
         size_t const partition = partitioner_(key, num_partitions_);
 
-        auto it = intermediate_files_.find(partition);
-        if (it == intermediate_files_.cend())
-        {
-            it = intermediate_files_.insert(
-                    std::make_pair(
-                        partition,
-                        std::make_shared<intermediate_file_info>())).first;
-        }
-
-        if (it->second->filename.empty())
+        buffered_bytes_ += intermediate_files_[partition].buffer.insert(key, value);
+        if (memory_budget_ > 0  &&  buffered_bytes_ >= memory_budget_)
         {
-            it->second->filename = platform::get_temporary_filename();
-            assert(!it->second->write_stream.is_open());
+            uintmax_t const bytes = write_runs();
+            if (spill_counters_  &&  bytes > 0)
+            {
+                ++spill_counters_->spills;
+                spill_counters_->spilled_bytes += bytes;
+            }
         }
-
-        if (!it->second->write_stream.is_open())
-            it->second->write_stream.open(it->second->filename);
-        assert(it->second->write_stream.is_open());
-        return it->second->write_stream.write(key, value);
+        return true;
     }
 
+    // the combiner is given each key's buffered values, and its results
+    // are buffered in their place before all buffers are written to runs
     template<typename FnObj>
     void combine(FnObj &fn_obj)
     {
-        using std::swap;
-
-        this->close_files();
-        for (auto it=intermediate_files_.cbegin(); it!=intermediate_files_.cend(); ++it)
+        for (auto &fileinfo : intermediate_files_)
         {
-            std::string outfilename = platform::get_temporary_filename();
+            typename run_buffer::records_t records;
+            std::swap(records, fileinfo.buffer.records());
 
-            // run the combine function to combine records with the same key
-            auto &filename = it->second->filename;
-            combine_fn_(filename, outfilename);
-            detail::delete_file(filename);
-            swap(filename, outfilename);
+            auto record = records.cbegin();
+            while (record != records.cend())
+            {
+                auto const &key = record->first.first;
+                fn_obj.start(key);
+                for (; record!=records.cend()  &&  record->first.first == key; ++record)
+                {
+                    for (size_t loop=0; loop<record->second; ++loop)
+                        fn_obj(record->first.second);
+                }
+                fn_obj.finish(key, *this);
+            }
         }
-        this->close_files();
+        write_runs();
+    }
+
+    void combine(null_combiner &)
+    {
+        write_runs();
     }
 
     void merge_from(local_disk &other)
     {
         assert(num_partitions_ == other.num_partitions_);
         for (size_t partition=0; partition<num_partitions_; ++partition)
-        {
-            auto ito = other.intermediate_files_.find(partition);
-            if (ito != other.intermediate_files_.cend())
-            {
-                auto it = intermediate_files_.find(partition);
-                if (it == intermediate_files_.cend())
-                {
-                    it = intermediate_files_.insert(
-                            std::make_pair(
-                                partition,
-                                std::make_shared<intermediate_file_info>())).first;
-                }
+            merge_from(partition, other);
+    }
 
-                ito->second->write_stream.close();
-                if (ito->second->write_stream.sorted())
-                {
-                    it->second->fragment_filenames.push_back(ito->second->filename);
-                    ito->second->filename.clear();
-                }
-                else
-                {
-                    std::string sorted = platform::get_temporary_filename();
-                    combine_fn_(ito->second->filename, sorted);
-                    it->second->fragment_filenames.push_back(sorted);
-                }
-                assert(ito->second->fragment_filenames.empty());
-            }
-        }
+    // partitions may be merged concurrently, as each touches only its own
+    // entry of intermediate_files_
+    void merge_from(size_t const partition, local_disk &other)
+    {
+        intermediate_file_info &from = other.intermediate_files_[partition];
+        intermediate_file_info &to   = intermediate_files_[partition];
+
+        // the map output is normally combined, and so written, already
+        if (!from.buffer.empty())
+            other.write_run(from);
+        to.fragment_filenames.splice(to.fragment_filenames.end(), from.fragment_filenames);
     }
 
     void run_intermediate_results_shuffle(size_t const partition)
@@ -573,91 +475,102 @@ class local_disk : detail::noncopyable
 #ifdef DEBUG_TRACE_OUTPUT
         std::clog << "\nIntermediate Results Shuffle, Partition " << partition << "...";
 #endif
-        auto it = intermediate_files_.find(partition);
-        assert(it != intermediate_files_.cend());
-        it->second->write_stream.close();
+        // a partition that no key was partitioned to, which a
+        // range_partitioner can leave, has no runs
+        intermediate_file_info &fileinfo = intermediate_files_[partition];
+        if (!fileinfo.buffer.empty())
+            write_run(fileinfo);
 
-        MergeFn merge_fn;
-        if (!it->second->fragment_filenames.empty())
+        if (fileinfo.fragment_filenames.size() == 1)
         {
-            it->second->filename = platform::get_temporary_filename();
-            merge_fn(it->second->fragment_filenames, it->second->filename);
+            // a single run is already sorted
+            fileinfo.filename = fileinfo.fragment_filenames.front();
+            fileinfo.fragment_filenames.clear();
+        }
+        else if (!fileinfo.fragment_filenames.empty())
+        {
+            MergeFn merge_fn;
+            fileinfo.filename = platform::get_temporary_filename();
+            merge_fn(fileinfo.fragment_filenames, fileinfo.filename, &codec_);
+            fileinfo.fragment_filenames.clear();
         }
     }
 
     template<typename Callback>
     void reduce(size_t const partition, Callback &callback)
     {
+        using std::swap;
+
 #ifdef DEBUG_TRACE_OUTPUT
         std::clog << "\nReduce Phase running for partition " << partition << "...";
 #endif
 
-        auto it = intermediate_files_.find(partition);
-        assert(it != intermediate_files_.cend());
-
+        // the entry is left without a file, so begin_results() skips it
         std::string filename;
-        swap(filename, it->second->filename);
-        it->second->write_stream.close();
-        intermediate_files_.erase(it);
-
-        std::pair<
-            typename reduce_task_type::key_type,
-            typename reduce_task_type::value_type> kv;
-        typename reduce_task_type::key_type   last_key;
-        std::list<typename reduce_task_type::value_type> values;
-        std::ifstream infile(filename.c_str());
-        while (!(infile >> kv).eof())
+        swap(filename, intermediate_files_[partition].filename);
+        if (filename.empty())
+            return;
+
+        typename record_format_type::record_type           kv;
+        typename reduce_task_type::key_type                last_key;
+        std::vector<typename reduce_task_type::value_type> values;
+        bool have_key = false;
         {
-            if (kv.first != last_key  &&  length(kv.first) > 0)
+            detail::record_reader infile(filename, 1 << 20, false, &codec_);
+            while (record_format_type::read(infile, kv))
             {
-                if (length(last_key) > 0)
+                if (!have_key  ||  kv.first != last_key)
                 {
-                    callback(last_key, values.cbegin(), values.cend());
-                    values.clear();
-                }
-                if (length(kv.first) > 0)
+                    if (have_key)
+                    {
+                        callback(last_key, detail::values_begin(values), detail::values_end(values));
+                        values.clear();
+                    }
                     swap(kv.first, last_key);
-            }
+                    have_key = true;
+                }
 
-            values.push_back(kv.second);
+                values.push_back(kv.second);
+            }
         }
 
-        if (length(last_key) > 0)
-            callback(last_key, values.cbegin(), values.cend());
+        if (have_key)
+            callback(last_key, detail::values_begin(values), detail::values_end(values));
 
-        infile.close();
         detail::delete_file(filename.c_str());
     }
 
-    static bool const read_record(std::istream &infile,
-                                  typename reduce_task_type::key_type   &key,
-                                  typename reduce_task_type::value_type &value)
+  private:
+    // write the buffer of every partition to a run; returns the bytes written
+    uintmax_t const write_runs()
     {
-        std::pair<typename reduce_task_type::key_type,
-                  typename reduce_task_type::value_type> keyvalue;
-        infile >> keyvalue;
-        if (infile.eof()  ||  infile.fail())
-            return false;
-
-        key   = keyvalue.first;
-        value = keyvalue.second;
-        return true;
+        uintmax_t bytes = 0;
+        for (auto &fileinfo : intermediate_files_)
+        {
+            if (!fileinfo.buffer.empty())
+                bytes += write_run(fileinfo);
+        }
+        buffered_bytes_ = 0;
+        return bytes;
     }
 
-  private:
-    void close_files()
+    uintmax_t const write_run(intermediate_file_info &fileinfo)
     {
-        for (auto it=intermediate_files_.cbegin(); it!=intermediate_files_.cend(); ++it)
-            it->second->write_stream.close();
+        std::string const filename = platform::get_temporary_filename();
+        fileinfo.fragment_filenames.push_back(filename);
+        return fileinfo.buffer.write(filename, codec_);
     }
 
   private:
     typedef enum { map_phase, reduce_phase } phase_t;
 
-    size_t const    num_partitions_;
-    intermediates_t intermediate_files_;
-    CombineFile     combine_fn_;
-    PartitionFn     partitioner_;
+    size_t const             num_partitions_;
+    intermediates_t          intermediate_files_;
+    PartitionFn              partitioner_;
+    size_t                   memory_budget_;
+    size_t                   buffered_bytes_;    // estimated memory held by the buffers
+    detail::spill_counters  *spill_counters_;
+    detail::block_codec      codec_;
 };
 
 }   // namespace intermediates
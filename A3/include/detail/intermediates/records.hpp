@@ -0,0 +1,672 @@
+// Copyright (c) 2009-2016 Craig Henderson
+// https://github.com/cdmh/mapreduce
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <future>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <boost/iostreams/device/array.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
+#include <boost/iostreams/filter/zlib.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+
+namespace mapreduce {
+
+namespace detail {
+
+// counted by all of the intermediate stores of a job that spill to disk
+struct spill_counters
+{
+    spill_counters()
+    {
+        reset();
+    }
+
+    void reset()
+    {
+        spills           = 0;
+        spilled_bytes    = 0;
+        raw_bytes        = 0;
+        compressed_bytes = 0;
+        codec_time       = 0;
+
+        std::lock_guard<std::mutex> lock(partitions_mutex_);
+        partition_spills.clear();
+        partition_spilled_bytes.clear();
+    }
+
+    // for stores that spill single partitions
+    void partition_spilled(size_t const partition, uintmax_t const bytes)
+    {
+        std::lock_guard<std::mutex> lock(partitions_mutex_);
+        if (partition_spills.size() <= partition)
+        {
+            partition_spills.resize(partition+1);
+            partition_spilled_bytes.resize(partition+1);
+        }
+        ++partition_spills[partition];
+        partition_spilled_bytes[partition] += bytes;
+    }
+
+    std::atomic<size_t>    spills;
+    std::atomic<uintmax_t> spilled_bytes;
+    std::atomic<uintmax_t> raw_bytes;           // bytes compressed
+    std::atomic<uintmax_t> compressed_bytes;    // bytes they compressed to
+    std::atomic<int64_t>   codec_time;          // nanoseconds compressing and decompressing
+
+    // indexed by partition, and only changed by partition_spilled
+    std::vector<size_t>    partition_spills;
+    std::vector<uintmax_t> partition_spilled_bytes;
+
+  private:
+    std::mutex             partitions_mutex_;
+};
+
+// Block compression of intermediate files. A record_writer with a codec
+// compresses each buffer as one block, written after its compressed and
+// uncompressed sizes, and a record_reader with the same codec reverses it.
+// The codec runs through a boost::iostreams filter.
+class block_codec
+{
+  public:
+    block_codec(compression const method = compression::none, spill_counters *counters = 0)
+      : method_(method),
+        counters_(counters)
+    {
+    }
+
+    bool const enabled() const
+    {
+        return method_ != compression::none;
+    }
+
+    void compress(char const *data, size_t const size, std::vector<char> &block) const
+    {
+        auto const start_time = std::chrono::steady_clock::now();
+
+        block.clear();
+        boost::iostreams::filtering_ostream stream;
+        stream.push(boost::iostreams::zlib_compressor(boost::iostreams::zlib::best_speed));
+        stream.push(boost::iostreams::back_inserter(block));
+        stream.write(data, size);
+        stream.reset();
+
+        if (counters_)
+        {
+            counters_->raw_bytes        += size;
+            counters_->compressed_bytes += block.size();
+            counters_->codec_time       += elapsed(start_time);
+        }
+    }
+
+    bool const decompress(char const *block, size_t const block_size, char *data, size_t const size) const
+    {
+        auto const start_time = std::chrono::steady_clock::now();
+
+        boost::iostreams::filtering_istream stream;
+        stream.push(boost::iostreams::zlib_decompressor());
+        stream.push(boost::iostreams::array_source(block, block_size));
+        stream.read(data, size);
+        bool const success = (size_t(stream.gcount()) == size);
+
+        if (counters_)
+            counters_->codec_time += elapsed(start_time);
+        return success;
+    }
+
+  private:
+    static int64_t const elapsed(std::chrono::steady_clock::time_point const start_time)
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_time).count();
+    }
+
+  private:
+    compression     method_;
+    spill_counters *counters_;
+};
+
+// the sizes written before each compressed block
+struct block_header
+{
+    uint32_t compressed_size;
+    uint32_t size;
+};
+
+// bytes written to a file through a large buffer, compressed a buffer at a
+// time if a codec is given
+class record_writer : detail::noncopyable
+{
+  public:
+    explicit record_writer(size_t const buffer_size = 1 << 20, block_codec const *codec = 0)
+      : file_(0),
+        used_(0),
+        written_(0),
+        file_bytes_(0),
+        failed_(false),
+        codec_((codec  &&  codec->enabled())? codec : 0)
+    {
+        buffer_.resize(buffer_size);
+    }
+
+    ~record_writer()
+    {
+        close();
+    }
+
+    bool const open(std::string const &filename)
+    {
+        close();
+        file_       = std::fopen(filename.c_str(), "wb");
+        written_    = 0;
+        file_bytes_ = 0;
+        failed_  = (file_ == 0);
+        return !failed_;
+    }
+
+    bool const is_open() const
+    {
+        return file_ != 0;
+    }
+
+    void close()
+    {
+        if (file_)
+        {
+            flush();
+            failed_ = (std::fclose(file_) != 0)  ||  failed_;
+            file_   = 0;
+        }
+    }
+
+    bool const fail() const
+    {
+        return failed_;
+    }
+
+    // bytes written since the file was opened, before any compression
+    uintmax_t const bytes_written() const
+    {
+        return written_;
+    }
+
+    // bytes that have reached the file, after any compression, and with the
+    // block headers; all of them once the file is closed
+    uintmax_t const file_bytes() const
+    {
+        return file_bytes_;
+    }
+
+    void write(void const *data, size_t size)
+    {
+        written_ += size;
+
+        char const *source = static_cast<char const *>(data);
+        while (size > 0)
+        {
+            if (used_ == buffer_.size())
+                flush();
+
+            size_t const count = std::min(size, buffer_.size() - used_);
+            std::memcpy(&buffer_[used_], source, count);
+            used_  += count;
+            source += count;
+            size   -= count;
+        }
+    }
+
+    void put(char const ch)
+    {
+        if (used_ == buffer_.size())
+            flush();
+        buffer_[used_++] = ch;
+        ++written_;
+    }
+
+  private:
+    void flush()
+    {
+        if (used_ == 0)
+            return;
+
+        if (codec_)
+        {
+            codec_->compress(&buffer_[0], used_, block_);
+
+            block_header const header = { uint32_t(block_.size()), uint32_t(used_) };
+            failed_ = (std::fwrite(&header, sizeof(header), 1, file_) != 1)  ||  failed_;
+            failed_ = (std::fwrite(block_.data(), 1, block_.size(), file_) != block_.size())  ||  failed_;
+            file_bytes_ += sizeof(header) + block_.size();
+        }
+        else
+        {
+            failed_ = (std::fwrite(&buffer_[0], 1, used_, file_) != used_)  ||  failed_;
+            file_bytes_ += used_;
+        }
+        used_ = 0;
+    }
+
+  private:
+    std::FILE               *file_;
+    std::vector<char>        buffer_;
+    std::vector<char>        block_;        // compressed buffer
+    size_t                   used_;
+    uintmax_t                written_;
+    uintmax_t                file_bytes_;
+    bool                     failed_;
+    block_codec const *const codec_;
+};
+
+// bytes read from a file through a large buffer. with prefetch, a second
+// buffer is filled with the next block in the background while the current
+// block is consumed
+class record_reader : detail::noncopyable
+{
+  public:
+    explicit record_reader(size_t const buffer_size = 1 << 20, bool const prefetch = false, block_codec const *codec = 0)
+      : file_(0),
+        position_(0),
+        available_(0),
+        prefetch_(prefetch),
+        codec_((codec  &&  codec->enabled())? codec : 0)
+    {
+        buffer_.resize(buffer_size);
+        if (prefetch_)
+            next_.resize(buffer_size);
+    }
+
+    explicit record_reader(std::string const &filename, size_t const buffer_size = 1 << 20, bool const prefetch = false, block_codec const *codec = 0)
+      : file_(0),
+        position_(0),
+        available_(0),
+        prefetch_(prefetch),
+        codec_((codec  &&  codec->enabled())? codec : 0)
+    {
+        buffer_.resize(buffer_size);
+        if (prefetch_)
+            next_.resize(buffer_size);
+        open(filename);
+    }
+
+    ~record_reader()
+    {
+        close();
+    }
+
+    bool const open(std::string const &filename)
+    {
+        close();
+        file_ = std::fopen(filename.c_str(), "rb");
+        if (file_  &&  prefetch_)
+            read_ahead();
+        return file_ != 0;
+    }
+
+    bool const is_open() const
+    {
+        return file_ != 0;
+    }
+
+    void close()
+    {
+        if (next_block_.valid())
+            next_block_.wait();
+        next_block_ = std::future<size_t>();
+
+        if (file_)
+            std::fclose(file_);
+        file_      = 0;
+        position_  = 0;
+        available_ = 0;
+    }
+
+    // false if fewer than size bytes remain
+    bool const read(void *data, size_t size)
+    {
+        char *dest = static_cast<char *>(data);
+        while (size > 0)
+        {
+            if (position_ == available_  &&  !fill())
+                return false;
+
+            size_t const count = std::min(size, available_ - position_);
+            std::memcpy(dest, &buffer_[position_], count);
+            position_ += count;
+            dest      += count;
+            size      -= count;
+        }
+        return true;
+    }
+
+    bool const get(char &ch)
+    {
+        if (position_ == available_  &&  !fill())
+            return false;
+        ch = buffer_[position_++];
+        return true;
+    }
+
+  private:
+    bool const fill()
+    {
+        position_ = 0;
+        if (!file_)
+            available_ = 0;
+        else if (!prefetch_)
+            available_ = read_block(buffer_);
+        else if (!next_block_.valid())
+            available_ = 0;     // end of file was reached by the last block
+        else
+        {
+            available_ = next_block_.get();
+            buffer_.swap(next_);
+            if (available_ > 0)
+                read_ahead();
+        }
+        return available_ > 0;
+    }
+
+    // read the next block into next_ on another thread
+    void read_ahead()
+    {
+        next_block_ = std::async(std::launch::async, [this]() {
+            return read_block(next_);
+        });
+    }
+
+    // returns the number of bytes read into the buffer, which grows if a
+    // compressed block holds more than it can
+    size_t const read_block(std::vector<char> &buffer)
+    {
+        if (!codec_)
+            return std::fread(&buffer[0], 1, buffer.size(), file_);
+
+        block_header header;
+        if (std::fread(&header, sizeof(header), 1, file_) != 1)
+            return 0;
+
+        block_.resize(header.compressed_size);
+        if (buffer.size() < header.size)
+            buffer.resize(header.size);
+        if (std::fread(block_.data(), 1, block_.size(), file_) != block_.size()
+        ||  !codec_->decompress(block_.data(), block_.size(), &buffer[0], header.size))
+        {
+            BOOST_THROW_EXCEPTION(std::runtime_error("A compressed intermediate file is corrupt"));
+        }
+        return header.size;
+    }
+
+  private:
+    std::FILE               *file_;
+    std::vector<char>        buffer_;
+    std::vector<char>        next_;
+    std::vector<char>        block_;        // compressed block
+    size_t                   position_;
+    size_t                   available_;
+    bool const               prefetch_;
+    block_codec const *const codec_;
+    std::future<size_t>      next_block_;
+};
+
+// Binary encoding of a key or value type in an intermediate file. Arithmetic
+// and enumeration types are written in their native fixed width, strings and
+// vectors as a varint length followed by the elements, and pairs as their
+// two members. Other types need a specialization with the same two functions.
+template<typename T, typename Enable=void>
+struct serializer;
+
+template<typename T>
+struct serializer<T, typename std::enable_if<std::is_arithmetic<T>::value  ||  std::is_enum<T>::value>::type>
+{
+    static void write(record_writer &out, T const &value)
+    {
+        out.write(&value, sizeof(value));
+    }
+
+    static bool const read(record_reader &in, T &value)
+    {
+        return in.read(&value, sizeof(value));
+    }
+};
+
+// The heap memory held by a key or value, for the memory budget of an
+// intermediate store; types that are not strings, vectors or pairs of them
+// are taken to hold none.
+template<typename Char, typename Traits, typename Alloc>
+size_t const dynamic_size(std::basic_string<Char, Traits, Alloc> const &value);
+template<typename T, typename Alloc>
+size_t const dynamic_size(std::vector<T, Alloc> const &value);
+template<typename First, typename Second>
+size_t const dynamic_size(std::pair<First, Second> const &value);
+
+template<typename T>
+size_t const dynamic_size(T const &)
+{
+    return 0;
+}
+
+template<typename Char, typename Traits, typename Alloc>
+size_t const dynamic_size(std::basic_string<Char, Traits, Alloc> const &value)
+{
+    return value.capacity() * sizeof(Char);
+}
+
+template<typename T, typename Alloc>
+size_t const dynamic_size(std::vector<T, Alloc> const &value)
+{
+    size_t size = value.capacity() * sizeof(T);
+    for (auto const &element : value)
+        size += dynamic_size(element);
+    return size;
+}
+
+template<typename First, typename Second>
+size_t const dynamic_size(std::pair<First, Second> const &value)
+{
+    return dynamic_size(value.first) + dynamic_size(value.second);
+}
+
+// LEB128: seven bits a byte, the high bit set on all but the last byte
+inline void write_varint(record_writer &out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        out.put(char((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.put(char(value));
+}
+
+inline bool const read_varint(record_reader &in, uint64_t &value)
+{
+    value = 0;
+    for (unsigned shift=0; shift<64; shift+=7)
+    {
+        char ch;
+        if (!in.get(ch))
+            return false;
+        value |= uint64_t(ch & 0x7f) << shift;
+        if ((ch & 0x80) == 0)
+            return true;
+    }
+    return false;
+}
+
+template<typename Char, typename Traits, typename Alloc>
+struct serializer<std::basic_string<Char, Traits, Alloc>>
+{
+    typedef std::basic_string<Char, Traits, Alloc> string_type;
+
+    static void write(record_writer &out, string_type const &value)
+    {
+        write_varint(out, value.size());
+        out.write(value.data(), value.size() * sizeof(Char));
+    }
+
+    static bool const read(record_reader &in, string_type &value)
+    {
+        uint64_t size;
+        if (!read_varint(in, size))
+            return false;
+
+        value.resize(size_t(size));
+        return size == 0  ||  in.read(&value[0], size_t(size) * sizeof(Char));
+    }
+};
+
+template<typename T, typename Alloc>
+struct serializer<std::vector<T, Alloc>>
+{
+    static void write(record_writer &out, std::vector<T, Alloc> const &value)
+    {
+        write_varint(out, value.size());
+        for (auto const &element : value)
+            serializer<T>::write(out, element);
+    }
+
+    static bool const read(record_reader &in, std::vector<T, Alloc> &value)
+    {
+        uint64_t size;
+        if (!read_varint(in, size))
+            return false;
+
+        value.resize(size_t(size));
+        for (auto &element : value)
+        {
+            if (!serializer<T>::read(in, element))
+                return false;
+        }
+        return true;
+    }
+};
+
+template<typename First, typename Second>
+struct serializer<std::pair<First, Second>>
+{
+    static void write(record_writer &out, std::pair<First, Second> const &value)
+    {
+        serializer<First>::write(out, value.first);
+        serializer<Second>::write(out, value.second);
+    }
+
+    static bool const read(record_reader &in, std::pair<First, Second> &value)
+    {
+        return serializer<First>::read(in, value.first)
+           &&  serializer<Second>::read(in, value.second);
+    }
+};
+
+// the next non-empty '\r' terminated line
+inline bool const read_line(record_reader &in, std::string &line)
+{
+    line.clear();
+    char ch;
+    while (in.get(ch))
+    {
+        if (ch != '\r')
+            line += ch;
+        else if (!line.empty())
+            break;
+    }
+    return !line.empty();
+}
+
+// whole '\r' terminated lines as records, compared as strings
+struct line_records
+{
+    typedef std::string record_type;
+
+    static void write(record_writer &out, record_type const &record)
+    {
+        out.write(record.data(), record.size());
+        out.put('\r');
+    }
+
+    static bool const read(record_reader &in, record_type &record)
+    {
+        return read_line(in, record);
+    }
+};
+
+}   // namespace detail
+
+namespace intermediates {
+
+// The record format of the intermediate files of local_disk. Every record
+// is a key and a value, written with detail::serializer.
+template<typename Key, typename Value>
+struct binary_records
+{
+    typedef std::pair<Key, Value> record_type;
+
+    static void write(detail::record_writer &out, record_type const &record)
+    {
+        detail::serializer<record_type>::write(out, record);
+    }
+
+    static bool const read(detail::record_reader &in, record_type &record)
+    {
+        return detail::serializer<record_type>::read(in, record);
+    }
+};
+
+// The original text format, one record per '\r' terminated line, written
+// and read with operator<< and operator>> on std::pair<Key, Value>. It is
+// slower, and values must not contain '\r', but the files are readable
+// when debugging.
+template<typename Key, typename Value>
+struct text_records
+{
+    typedef std::pair<Key, Value> record_type;
+
+    static void write(detail::record_writer &out, record_type const &record)
+    {
+        std::ostringstream line;
+        line << record;
+        out.write(line.str().data(), line.str().size());
+        out.put('\r');
+    }
+
+    static bool const read(detail::record_reader &in, record_type &record)
+    {
+        std::string line;
+        if (!detail::read_line(in, line))
+            return false;
+
+        std::istringstream stream(line);
+        stream >> record;
+        return !stream.fail();
+    }
+};
+
+}   // namespace intermediates
+
+}   // namespace mapreduce
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
@@ -0,0 +1,86 @@
+// Copyright (c) 2009-2016 Craig Henderson
+// https://github.com/cdmh/mapreduce
+
+#pragma once
+
+namespace mapreduce {
+
+// Runs a job again and again, for iterative algorithms such as PageRank.
+// The job, with its intermediate store, map workers and partitioner, and the
+// schedule policy, with its thread pool, are kept from one iteration to the
+// next, so their containers are reused rather than allocated again. Before
+// each iteration the caller updates the state that the map tasks read, see
+// job::broadcast, and the datasource is rewound to its first key, so it
+// must have
+//     void rewind();
+// as datasource::container does. Each iteration's results go to the job's
+// result target, see job::result_target, and run() returns the job's
+// result_reduction of them, for the caller's convergence test.
+template<typename Job, typename SchedulePolicy>
+class iterative_job : detail::noncopyable
+{
+  public:
+    iterative_job(typename Job::datasource_type &datasource, specification const &spec)
+      : datasource_(datasource),
+        job_(datasource, spec),
+        iterations_(0)
+    {
+        static_assert(detail::store_result_target<typename Job::store_result_type>::consumes_results, "iterative_job requires a StoreResult that writes the results to a target");
+    }
+
+    iterative_job(typename Job::datasource_type &datasource, specification const &spec, thread_pool &pool)
+      : datasource_(datasource),
+        job_(datasource, spec),
+        schedule_(pool),
+        iterations_(0)
+    {
+        static_assert(detail::store_result_target<typename Job::store_result_type>::consumes_results, "iterative_job requires a StoreResult that writes the results to a target");
+    }
+
+    Job &job()
+    {
+        return job_;
+    }
+
+    size_t const iterations() const
+    {
+        return iterations_;
+    }
+
+    // run one iteration; result is replaced by the iteration's results
+    double const run(results &result)
+    {
+        if (iterations_++ > 0)
+            datasource_.rewind();
+
+        result = results();
+        job_.run(schedule_, result);
+        return result.result_reduction;
+    }
+
+  private:
+    typename Job::datasource_type &datasource_;
+    Job                            job_;
+    SchedulePolicy                 schedule_;
+    size_t                         iterations_;
+};
+
+}   // namespace mapreduce
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
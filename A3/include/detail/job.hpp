@@ -3,10 +3,162 @@
 
 #pragma once
 
+#include <atomic>
 #include "datasource.hpp"
+#include "thread_pool.hpp"
 
 namespace mapreduce {
 
+namespace detail {
+
+// An intermediate store may optionally divide a partition into pieces that
+// are reduced by different threads, with
+//     size_t const partition_key_count(size_t const partition) const;
+//     size_t const split_partition(size_t const partition, size_t const pieces);
+//     template<typename Callback>
+//     void reduce(size_t const partition, size_t const piece, Callback &callback);
+// split_partition detaches the partition's intermediate values, so results
+// emitted by the reduce go into a fresh partition as usual.
+template<typename Store>
+class has_split_partition
+{
+    template<typename S>
+    static auto test(int) -> decltype(std::declval<S &>().split_partition(size_t(), size_t()), std::true_type());
+
+    template<typename S>
+    static std::false_type test(...);
+
+  public:
+    static bool const value = decltype(test<Store>(0))::value;
+};
+
+// An intermediate store may optionally hold its values in memory only up to
+// a budget, spilling them to disk when it is reached, with
+//     void configure_spill(spill_settings const &settings);
+// every store of a job counts its spills in the job's spill_counters.
+struct spill_settings
+{
+    size_t          memory_budget;
+    compression     codec;
+    spill_counters *counters;
+};
+
+template<typename Store>
+class has_configure_spill
+{
+    template<typename S>
+    static auto test(int) -> decltype(std::declval<S &>().configure_spill(std::declval<spill_settings const &>()), std::true_type());
+
+    template<typename S>
+    static std::false_type test(...);
+
+  public:
+    static bool const value = decltype(test<Store>(0))::value;
+};
+
+// A store that allocates from arenas, such as intermediates::in_memory, has
+//     void arena_counters(arena_counters *counters);
+//     void report_arenas();
+template<typename Store>
+class has_arenas
+{
+    template<typename S>
+    static auto test(int) -> decltype(std::declval<S &>().arena_counters(static_cast<arena_counters *>(0)), std::true_type());
+
+    template<typename S>
+    static std::false_type test(...);
+
+  public:
+    static bool const value = decltype(test<Store>(0))::value;
+};
+
+// A combiner with
+//     void fold(value_type &accumulated, value_type const &value) const;
+// such as combiners::sum, folds each value into the value already held for
+// its key as the map task emits it, if the intermediate store has
+//     template<typename Combiner>
+//     bool const insert_combined(key_type const &key, value_type const &value, Combiner const &combiner);
+// which returns true if value was folded rather than stored. the store then
+// holds one value per key, and the combiner is not run after the map task.
+template<typename Store, typename Combiner>
+class can_combine_on_insert
+{
+    typedef typename Store::reduce_task_type::value_type value_type;
+
+    template<typename S, typename C>
+    static auto test(int) -> decltype(
+        std::declval<C const &>().fold(std::declval<value_type &>(), std::declval<value_type const &>()),
+        std::declval<S &>().insert_combined(std::declval<typename S::key_type const &>(), std::declval<value_type const &>(), std::declval<C const &>()),
+        std::true_type());
+
+    template<typename S, typename C>
+    static std::false_type test(...);
+
+  public:
+    static bool const value = decltype(test<Store, Combiner>(0))::value;
+};
+
+template<typename T>
+struct always_void
+{
+    typedef void type;
+};
+
+// A partitioner may spread a key over several partitions, see
+// range_partitioner, and then lists them with
+//     std::vector<spread_key> spread_keys() const;
+// where spread_key has members key, first and count
+template<typename PartitionFn>
+class has_spread_keys
+{
+    template<typename P>
+    static auto test(int) -> decltype(std::declval<P const &>().spread_keys(), std::true_type());
+
+    template<typename P>
+    static std::false_type test(...);
+
+  public:
+    static bool const value = decltype(test<PartitionFn>(0))::value;
+};
+
+// A map task with a broadcast_type reads state that is the same for every
+// key, and may change each time the job is run, through runtime.broadcast(),
+// see job::broadcast
+struct no_broadcast
+{
+};
+
+template<typename MapTask, typename Enable=void>
+struct map_task_broadcast
+{
+    typedef no_broadcast type;
+};
+
+template<typename MapTask>
+struct map_task_broadcast<MapTask, typename always_void<typename MapTask::broadcast_type>::type>
+{
+    typedef typename MapTask::broadcast_type type;
+};
+
+// A StoreResult with a target_type consumes the reduce results: each one is
+// written to a target that the caller gives to job::result_target, and is
+// not inserted back into the intermediate store.
+template<typename StoreResult, typename Enable=void>
+struct store_result_target
+{
+    typedef void type;
+    static bool const consumes_results = false;
+};
+
+template<typename StoreResult>
+struct store_result_target<StoreResult, typename always_void<typename StoreResult::target_type>::type>
+{
+    typedef typename StoreResult::target_type type;
+    static bool const consumes_results = true;
+};
+
+}   // namespace detail
+
 template<typename T> uintmax_t    const length(T const &str);
 template<typename T> char const * const data(T const &str);
 
@@ -52,6 +204,15 @@ class job : detail::noncopyable
     typedef Combiner          combiner_type;
     typedef Datasource        datasource_type;
     typedef IntermediateStore intermediate_store_type;
+    typedef StoreResult       store_result_type;
+
+    typedef
+    typename detail::map_task_broadcast<MapTask>::type
+    broadcast_type;
+
+    typedef
+    std::function<double (typename ReduceTask::key_type const &, typename ReduceTask::value_type const &)>
+    result_reduction_type;
 
     typedef
     typename intermediate_store_type::const_result_iterator
@@ -61,6 +222,10 @@ class job : detail::noncopyable
     typename intermediate_store_type::keyvalue_t
     keyvalue_t;
 
+    typedef
+    typename detail::store_result_target<StoreResult>::type
+    result_target_type;
+
   private:
     class map_task_runner : detail::noncopyable
     {
@@ -69,28 +234,66 @@ class job : detail::noncopyable
 
         explicit map_task_runner(job &j)
           : job_(j),
-            intermediate_store_(job_.number_of_partitions())
+            intermediate_store_(job_.number_of_partitions()),
+            combiner_(job_.combiner_),
+            combined_values_(0),
+            emitted_values_(0),
+            emitted_bytes_(0)
         {
+            job_.configure_store(intermediate_store_);
         }
 
         // 'value' parameter is not a reference to const to enable streams to be passed
         map_task_runner &operator()(typename map_task_type::key_type const &key,
                                     typename map_task_type::value_type     &value)
         {
-            map_task_type()(*this, key, value);
+            map(key, value);
+            combine();
+            return *this;
+        }
 
-            // consolidating map intermediate results can save time by
-            // aggregating the mapped valued at mapper
-            combiner_type instance;
-            intermediate_store_.combine(instance);
+        void map(typename map_task_type::key_type const &key,
+                 typename map_task_type::value_type     &value)
+        {
+            map_task_type()(*this, key, value);
+        }
 
-            return *this;
+        void combine()
+        {
+            combine(combines_on_insert());
+            job_.combined_values_ += combined_values_;
+            combined_values_ = 0;
         }
 
         template<typename T>
         bool const emit_intermediate(T const &key, typename reduce_task_type::value_type const &value)
         {
-            return intermediate_store_.insert(key, value);
+            ++emitted_values_;
+            emitted_bytes_ += sizeof(key) + detail::dynamic_size(key) + sizeof(value) + detail::dynamic_size(value);
+            return emit_intermediate(key, value, combines_on_insert());
+        }
+
+        // add the values emitted since the last report to the counters of
+        // the thread's results
+        void report(results &result)
+        {
+            result.counters.emitted_values += emitted_values_;
+            result.counters.emitted_bytes  += emitted_bytes_;
+            emitted_values_ = 0;
+            emitted_bytes_  = 0;
+        }
+
+        broadcast_type const &broadcast() const
+        {
+            assert(job_.broadcast_);
+            return *job_.broadcast_;
+        }
+
+        // a worker that is kept for another run of the job takes the job's
+        // current combiner
+        void restart()
+        {
+            combiner_ = job_.combiner_;
         }
 
         intermediate_store_type &intermediate_store()
@@ -99,24 +302,72 @@ class job : detail::noncopyable
         }
 
       private:
+        typedef
+        std::integral_constant<bool, detail::can_combine_on_insert<IntermediateStore, Combiner>::value>
+        combines_on_insert;
+
+        void combine(std::true_type)
+        {
+        }
+
+        void combine(std::false_type)
+        {
+            // consolidating map intermediate results can save time by
+            // aggregating the mapped valued at mapper
+            combiner_type instance(combiner_);
+            intermediate_store_.combine(instance);
+            combined_values_ += detail::values_folded(instance, 0);
+        }
+
+        template<typename T>
+        bool const emit_intermediate(T const &key, typename reduce_task_type::value_type const &value, std::true_type)
+        {
+            if (intermediate_store_.insert_combined(key, value, combiner_))
+                ++combined_values_;
+            return true;
+        }
+
+        template<typename T>
+        bool const emit_intermediate(T const &key, typename reduce_task_type::value_type const &value, std::false_type)
+        {
+            return intermediate_store_.insert(key, value);
+        }
+
         job                     &job_;
         intermediate_store_type  intermediate_store_;
+        combiner_type            combiner_;
+        size_t                   combined_values_;  // not yet added to the job's count
+        uintmax_t                emitted_values_;   // not yet reported
+        uintmax_t                emitted_bytes_;
     };
 
     class reduce_task_runner : detail::noncopyable
     {
       public:
         reduce_task_runner(
-            std::string       const &output_filespec,
-            size_t            const &partition,
-            size_t            const  num_partitions,
-            intermediate_store_type &intermediate_store,
-            results                 &result)
-          : partition_(partition),
+            job                         &j,
+            std::string           const &output_filespec,
+            size_t                const &partition,
+            size_t                const  num_partitions,
+            intermediate_store_type     &intermediate_store,
+            results                     &result,
+            result_target_type          *target,
+            result_reduction_type const &reduction)
+          : job_(j),
+            partition_(partition),
             result_(result),
             intermediate_store_(intermediate_store),
-            store_result_(output_filespec, partition, num_partitions)
+            store_result_(output_filespec, partition, num_partitions),
+            reduction_(reduction),
+            reduced_(0.0)
         {
+            attach_target(target, consumes_results());
+        }
+
+        // the sum of the job's result_reduction over the results stored
+        double const reduced() const
+        {
+            return reduced_;
         }
 
         void reduce()
@@ -124,35 +375,223 @@ class job : detail::noncopyable
             intermediate_store_.reduce(partition_, *this);
         }
 
+        // reduce one piece of a partition divided by split_partition. other
+        // pieces of the partition may be reduced at the same time, so the
+        // output is kept until flush()
+        void reduce(size_t const piece)
+        {
+            buffered_ = true;
+            intermediate_store_.reduce(partition_, piece, *this);
+        }
+
+        void flush()
+        {
+            for (auto const &keyvalue : output_)
+                store(keyvalue.first, keyvalue.second, consumes_results());
+            output_.clear();
+        }
+
+        // the second level merge of a key spread over several partitions:
+        // reduce the partial results of its partitions, and store the result
+        template<typename Values>
+        void merge_spread_key(typename reduce_task_type::key_type const &key, Values const &partials)
+        {
+            bool const buffered = buffered_;
+            buffered_ = false;
+            merging_  = true;
+            reduce_task_type()(*this, key, detail::values_begin(partials), detail::values_end(partials));
+            merging_  = false;
+            buffered_ = buffered;
+        }
+
         void emit(typename reduce_task_type::key_type   const &key,
                   typename reduce_task_type::value_type const &value)
         {
-            intermediate_store_.insert(key, value, store_result_);
+            if (!merging_  &&  job_.add_partial_result(key, value))
+                return;
+
+            if (buffered_)
+                output_.push_back(std::make_pair(key, value));
+            else
+                store(key, value, consumes_results());
         }
 
         template<typename It>
         void operator()(typename reduce_task_type::key_type const &key, It it, It ite)
         {
             ++result_.counters.reduce_keys_executed;
+            ++result_.partition_keys[partition_];
+            result_.partition_values[partition_] += std::distance(it, ite);
             reduce_task_type()(*this, key, it, ite);
             ++result_.counters.reduce_keys_completed;
         }
 
       private:
-        size_t const            &partition_;
-        results                 &result_;
+        typedef
+        std::integral_constant<bool, detail::store_result_target<StoreResult>::consumes_results>
+        consumes_results;
+
+        void attach_target(result_target_type *target, std::true_type)
+        {
+            assert(target);
+            store_result_.target(*target);
+        }
+
+        void attach_target(result_target_type *, std::false_type)
+        {
+        }
+
+        void store(typename reduce_task_type::key_type   const &key,
+                   typename reduce_task_type::value_type const &value,
+                   std::true_type)
+        {
+            store_result_(key, value);
+            if (reduction_)
+                reduced_ += reduction_(key, value);
+        }
+
+        void store(typename reduce_task_type::key_type   const &key,
+                   typename reduce_task_type::value_type const &value,
+                   std::false_type)
+        {
+            intermediate_store_.insert(key, value, store_result_);
+            if (reduction_)
+                reduced_ += reduction_(key, value);
+        }
+
+        typedef
+        std::vector<
+            std::pair<
+                typename reduce_task_type::key_type,
+                typename reduce_task_type::value_type> >
+        output_t;
+
+        job                         &job_;
+        size_t const                &partition_;
+        results                     &result_;
+        intermediate_store_type     &intermediate_store_;
+        StoreResult                  store_result_;
+        bool                         buffered_ = false;
+        bool                         merging_  = false;
+        output_t                     output_;
+        result_reduction_type const &reduction_;
+        double                       reduced_;
+    };
+
+    // reduces intermediate values of a partition into intermediate values of
+    // the same partition of the job's store, which is only valid for an
+    // associative reduce function. a partitioner that spreads a key, such as
+    // range_partitioner, would put the results in a partition that another
+    // thread may be combining or reducing
+    class partial_reduce_runner : detail::noncopyable
+    {
+      public:
+        partial_reduce_runner(size_t const partition, intermediate_store_type &intermediate_store)
+          : partition_(partition),
+            intermediate_store_(intermediate_store)
+        {
+        }
+
+        void emit(typename reduce_task_type::key_type   const &key,
+                  typename reduce_task_type::value_type const &value)
+        {
+            intermediate_store_.insert(partition_, key, value);
+        }
+
+        template<typename It>
+        void operator()(typename reduce_task_type::key_type const &key, It it, It ite)
+        {
+            reduce_task_type()(*this, key, it, ite);
+        }
+
+      private:
+        size_t const             partition_;
         intermediate_store_type &intermediate_store_;
-        StoreResult              store_result_;
     };
 
   public:
+    // a map worker is the runner, and so the intermediate store, that one
+    // schedule thread keeps for all of its map keys
+    typedef map_task_runner map_worker;
+
+    // the datasource can hand out blocks of keys, see datasource::has_setup_keys
+    static bool const batched_map_keys = datasource::has_setup_keys<Datasource, typename MapTask::key_type>::value;
+
     job(datasource_type &datasource, specification const &spec)
       : datasource_(datasource),
         specification_(spec),
-        intermediate_store_(specification_.reduce_tasks)
+        intermediate_store_(specification_.reduce_tasks),
+        result_target_(0)
      {
+        configure_store(intermediate_store_, specification_.spill_memory_budget);
      }
 
+    // where a StoreResult that consumes the results writes them, see
+    // detail::store_result_target. the target must outlive the job's run
+    template<typename Target>
+    void result_target(Target &target)
+    {
+        static_assert(detail::store_result_target<StoreResult>::consumes_results, "the StoreResult does not write to a target");
+        result_target_ = &target;
+    }
+
+    // give the job a combiner that is constructed with arguments, such as
+    // combiners::function. each map task runs a copy of it
+    void combiner(combiner_type const &combiner)
+    {
+        combiner_ = combiner;
+    }
+
+    // state that the map tasks read through runtime.broadcast(), for a map
+    // task with a broadcast_type. the state is not copied, so must outlive
+    // the job's run, and it must not change while the job runs
+    void broadcast(broadcast_type const &state)
+    {
+        broadcast_ = &state;
+    }
+
+    // fn(key, value) is called for every result the reduce stores, by the
+    // thread that reduces it, and the sum of the calls is given in
+    // results::result_reduction, such as the change in each value since the
+    // previous run of an iterative job, see iterative_job
+    void result_reduction(result_reduction_type const &fn)
+    {
+        result_reduction_ = fn;
+    }
+
+    // give the job's intermediate stores a partitioner that is constructed
+    // with arguments, such as range_partitioner. the results of a key that
+    // the partitioner spreads over several partitions, see
+    // detail::has_spread_keys, are merged by reducing them again, once all
+    // of its partitions are reduced, in whichever reduce task finishes last
+    template<typename PartitionFn>
+    void partitioner(PartitionFn const &fn)
+    {
+        set_partitioner_ = [fn](intermediate_store_type &store) {
+            store.partitioner(fn);
+        };
+        set_partitioner_(intermediate_store_);
+        for (auto &worker : map_workers_)
+            set_partitioner_(worker->intermediate_store());
+
+        spread_keys_.clear();
+        add_spread_keys(fn, std::integral_constant<bool, detail::has_spread_keys<PartitionFn>::value>());
+    }
+
+    // record a timeline of the job's runs, which is written at the end of
+    // each run, see mapreduce::tracer. the tracer must outlive the job's
+    // runs, and a null tracer stops the tracing
+    void tracer(mapreduce::tracer *tracer)
+    {
+        tracer_ = tracer;
+    }
+
+    // for the schedule policies to record their own events
+    mapreduce::tracer *tracer() const
+    {
+        return tracer_;
+    }
+
     const_result_iterator begin_results() const
     {
         return intermediate_store_.begin_results();
@@ -163,6 +602,17 @@ class job : detail::noncopyable
         return intermediate_store_.end_results();
     }
 
+    // for consumers that do not need the results in key order
+    const_result_iterator begin_unordered_results() const
+    {
+        return intermediate_store_.begin_unordered_results();
+    }
+
+    const_result_iterator end_unordered_results() const
+    {
+        return intermediate_store_.end_unordered_results();
+    }
+
     bool const get_next_map_key(typename map_task_type::key_type *&key)
     {
         std::unique_ptr<typename map_task_type::key_type> next_key(new typename map_task_type::key_type);
@@ -172,6 +622,43 @@ class job : detail::noncopyable
         return true;
     }
 
+    // the store can divide a partition into pieces that are reduced
+    // concurrently, see detail::has_split_partition
+    static bool const splittable_partitions = detail::has_split_partition<IntermediateStore>::value;
+
+    // only available if splittable_partitions
+    size_t const partition_key_count(size_t const partition) const
+    {
+        return intermediate_store_.partition_key_count(partition);
+    }
+
+    // only available if splittable_partitions. called for every partition
+    // by one thread before any piece is reduced; returns the number of pieces
+    size_t const split_partition(size_t const partition, size_t const pieces)
+    {
+        size_t const count = intermediate_store_.split_partition(partition, pieces);
+
+        // each piece is a reduce task that a spread key waits for
+        std::lock_guard<std::mutex> lock(spread_keys_mutex_);
+        for (auto &spread : spread_keys_)
+        {
+            if (spread.second.spans(partition))
+                spread.second.remaining += count - 1;
+        }
+        return count;
+    }
+
+    // only available if batched_map_keys
+    size_t const get_next_map_keys(typename map_task_type::key_type *keys, size_t const max_keys)
+    {
+        return datasource_.setup_keys(keys, max_keys);
+    }
+
+    size_t const map_key_batch_size() const
+    {
+        return std::max<size_t>(1, specification_.map_key_batch_size);
+    }
+
     size_t const number_of_partitions() const
     {
         return specification_.reduce_tasks;
@@ -182,6 +669,35 @@ class job : detail::noncopyable
         return specification_.map_tasks;
     }
 
+    bool const per_thread_map_output() const
+    {
+        return specification_.per_thread_map_output;
+    }
+
+    // called once by each schedule thread. the workers, with their
+    // intermediate stores, are kept for the next run of the job and handed
+    // out again, so their containers are not allocated again
+    map_worker &make_map_worker()
+    {
+        std::lock_guard<std::mutex> lock(map_workers_mutex_);
+        if (map_workers_used_ < map_workers_.size())
+        {
+            map_worker &worker = *map_workers_[map_workers_used_++];
+            worker.restart();
+            return worker;
+        }
+
+        map_workers_.push_back(std::unique_ptr<map_worker>(new map_worker(*this)));
+        ++map_workers_used_;
+        return *map_workers_.back();
+    }
+
+    // called by the owning thread after its last map key
+    void finish_map_worker(map_worker &worker)
+    {
+        worker.combine();
+    }
+
     template<typename SchedulePolicy>
     void run(results &result)
     {
@@ -189,72 +705,212 @@ class job : detail::noncopyable
         run(schedule, result);
     }
 
+    // for schedule policies that run on a thread_pool, such as
+    // schedule_policy::pooled
+    template<typename SchedulePolicy>
+    void run(thread_pool &pool, results &result)
+    {
+        SchedulePolicy schedule(pool);
+        run(schedule, result);
+    }
+
     template<typename SchedulePolicy>
     void run(SchedulePolicy &schedule, results &result)
     {
         auto const start_time = std::chrono::system_clock::now();
-        schedule(*this, result);
+        map_workers_used_ = 0;
+        spill_counters_.reset();
+        arena_counters_.reset();
+        combined_values_ = 0;
+        result_reduction_total_ = 0.0;
+        for (auto &spread : spread_keys_)
+        {
+            spread.second.remaining = spread.second.count;
+            spread.second.partials.clear();
+        }
+        {
+            mapreduce::tracer::scope trace(tracer_, "job run");
+            schedule(*this, result);
+        }
         result.job_runtime = std::chrono::system_clock::now() - start_time;
+
+        result.result_reduction = result_reduction_total_;
+        result.counters.combined_values = combined_values_;
+        report_arenas(result, std::integral_constant<bool, detail::has_arenas<IntermediateStore>::value>());
+        if (detail::has_configure_spill<IntermediateStore>::value)
+            result.counters.spill_memory_budget = specification_.spill_memory_budget;
+        result.counters.num_spills         = spill_counters_.spills;
+        result.counters.spilled_bytes      = spill_counters_.spilled_bytes;
+        result.counters.uncompressed_bytes = spill_counters_.raw_bytes;
+        result.counters.compressed_bytes   = spill_counters_.compressed_bytes;
+        result.compression_runtime = std::chrono::nanoseconds(spill_counters_.codec_time);
+        if (detail::has_configure_spill<IntermediateStore>::value)
+        {
+            result.partition_spills        = spill_counters_.partition_spills;
+            result.partition_spilled_bytes = spill_counters_.partition_spilled_bytes;
+            result.partition_spills.resize(number_of_partitions());
+            result.partition_spilled_bytes.resize(number_of_partitions());
+        }
+        if (result.counters.compressed_bytes > 0)
+            result.compression_ratio = double(result.counters.uncompressed_bytes) / result.counters.compressed_bytes;
+
+        if (tracer_  &&  !tracer_->flush())
+            std::cerr << "\nError: failed to write the trace file " << tracer_->filename() << "\n";
     }
 
     template<typename Sync>
     bool const run_map_task(typename map_task_type::key_type *key, results &result, Sync &sync)
     {
-        auto const start_time = std::chrono::system_clock::now();
+        std::unique_ptr<typename map_task_type::key_type> map_key_ptr(key);
+        return run_map_task(*map_key_ptr, result, sync);
+    }
 
-        try
-        {
-            ++result.counters.map_keys_executed;
+    bool const run_map_task(typename map_task_type::key_type *key, results &result, map_worker &worker)
+    {
+        std::unique_ptr<typename map_task_type::key_type> map_key_ptr(key);
+        return run_map_task(*map_key_ptr, result, worker);
+    }
 
-            std::unique_ptr<typename map_task_type::key_type> map_key_ptr(key);
-            typename map_task_type::key_type &map_key = *map_key_ptr;
+    template<typename Sync>
+    bool const run_map_task(typename map_task_type::key_type &key, results &result, Sync &sync)
+    {
+        return execute_map_task(
+            key,
+            result,
+            [this, &sync, &result](typename map_task_type::key_type const &map_key,
+                                   typename map_task_type::value_type     &value) {
+                map_task_runner runner(*this);
+                runner(map_key, value);
+                runner.report(result);
 
-            // get some data
-            typename map_task_type::value_type value;
-            if (!datasource_.get_data(map_key, value))
-            {
-                ++result.counters.map_key_errors;
-                return false;
-            }
+                // merge the map task intermediate results into the job
+                auto const lock = detail::lock_timed(sync, result.lock_wait_time, tracer_);
+                mapreduce::tracer::scope trace(tracer_, "merge");
+                intermediate_store_.merge_from(runner.intermediate_store());
+            });
+    }
 
-            map_task_runner runner(*this);
-            runner(map_key, value);
+    // the map output stays in the worker's store until the shuffle, so no
+    // lock is taken per key
+    bool const run_map_task(typename map_task_type::key_type &key, results &result, map_worker &worker)
+    {
+        return execute_map_task(
+            key,
+            result,
+            [&worker, &result](typename map_task_type::key_type const &map_key,
+                               typename map_task_type::value_type     &value) {
+                worker.map(map_key, value);
+                worker.report(result);
+            });
+    }
 
-            // merge the map task intermediate results into the job
-            std::lock_guard<Sync> lock(sync);
-            intermediate_store_.merge_from(runner.intermediate_store());
-            ++result.counters.map_keys_completed;
-        }
-        catch (std::exception &e)
+    // each partition is shuffled by one thread, so the map workers' output
+    // for it is merged without a lock
+    void run_intermediate_results_shuffle(size_t const partition)
+    {
+        if (!map_workers_.empty())
         {
-            std::cerr << "\nError: " << e.what() << "\n";
-            ++result.counters.map_key_errors;
-            return false;
+            mapreduce::tracer::scope trace(tracer_, "merge", "partition", partition);
+            for (auto &worker : map_workers_)
+                intermediate_store_.merge_from(partition, worker->intermediate_store());
         }
-        result.map_times.push_back(std::chrono::system_clock::now() - start_time);
 
-        return true;
+        mapreduce::tracer::scope trace(tracer_, "shuffle", "partition", partition);
+        intermediate_store_.run_intermediate_results_shuffle(partition);
     }
 
-    void run_intermediate_results_shuffle(size_t const partition)
+    size_t const pipeline_buffer_keys() const
     {
-        intermediate_store_.run_intermediate_results_shuffle(partition);
+        return std::max<size_t>(1, specification_.pipeline_buffer_keys);
+    }
+
+    size_t const pipeline_queue_length() const
+    {
+        return std::max<size_t>(1, specification_.pipeline_queue_length);
+    }
+
+    // for an associative reduce function, reduce the values of a partition
+    // of `store` and add the results to the job's intermediate values of the
+    // partition. with the job's own store, the partition is compacted in
+    // place. a partition must only be combined by one thread at a time
+    void combine_partition(size_t const partition, intermediate_store_type &store)
+    {
+        mapreduce::tracer::scope trace(tracer_, "combine", "partition", partition);
+        partial_reduce_runner runner(partition, intermediate_store_);
+        store.reduce(partition, runner);
+    }
+
+    void combine_partition(size_t const partition)
+    {
+        combine_partition(partition, intermediate_store_);
+    }
+
+    // configure a store of map output, as the map workers' stores are, for
+    // a schedule policy that keeps stores of its own, such as the buffers
+    // of schedule_policy::pipelined. it has its share of the memory budget,
+    // see map_store_budget
+    void configure_store(intermediate_store_type &store)
+    {
+        configure_store(store, map_store_budget());
     }
 
     bool const run_reduce_task(size_t const partition, results &result)
+    {
+        return execute_reduce_task(
+            partition,
+            result,
+            [](reduce_task_runner &runner) {
+                runner.reduce();
+            });
+    }
+
+    // only available if splittable_partitions
+    bool const run_reduce_task(size_t const partition, size_t const piece, results &result)
+    {
+        return execute_reduce_task(
+            partition,
+            result,
+            [this, piece, &result](reduce_task_runner &runner) {
+                runner.reduce(piece);
+
+                auto const lock = detail::lock_timed(reduce_output_mutex_, result.lock_wait_time, tracer_);
+                runner.flush();
+            });
+    }
+
+  private:
+    template<typename ReduceFn>
+    bool const execute_reduce_task(size_t const partition, results &result, ReduceFn reduce_fn)
     {
         bool success = true;
 
         auto const start_time(std::chrono::system_clock::now());
+        mapreduce::tracer::scope trace(tracer_, "reduce", "partition", partition);
+        if (result.partition_keys.size() < number_of_partitions())
+        {
+            result.partition_keys.resize(number_of_partitions());
+            result.partition_values.resize(number_of_partitions());
+        }
+
         try
         {
             reduce_task_runner runner(
+                *this,
                 specification_.output_filespec,
                 partition,
                 number_of_partitions(),
                 intermediate_store_,
-                result);
-            runner.reduce();
+                result,
+                result_target_,
+                result_reduction_);
+            reduce_fn(runner);
+            merge_spread_keys(partition, runner, result);
+
+            if (result_reduction_)
+            {
+                auto const lock = detail::lock_timed(reduce_output_mutex_, result.lock_wait_time, tracer_);
+                result_reduction_total_ += runner.reduced();
+            }
         }
         catch (std::exception &e)
         {
@@ -263,15 +919,199 @@ class job : detail::noncopyable
             success = false;
         }
         
-        result.reduce_times.push_back(std::chrono::system_clock::now() - start_time);
+        result.reduce_times.record(std::chrono::system_clock::now() - start_time);
 
         return success;
     }
 
+    template<typename MapFn>
+    bool const execute_map_task(typename map_task_type::key_type &map_key, results &result, MapFn map_fn)
+    {
+        auto const start_time = std::chrono::system_clock::now();
+
+        try
+        {
+            ++result.counters.map_keys_executed;
+
+            // get some data
+            typename map_task_type::value_type value;
+            if (!datasource_.get_data(map_key, value))
+            {
+                ++result.counters.map_key_errors;
+                return false;
+            }
+
+            map_fn(map_key, value);
+            ++result.counters.map_keys_completed;
+        }
+        catch (std::exception &e)
+        {
+            std::cerr << "\nError: " << e.what() << "\n";
+            ++result.counters.map_key_errors;
+            return false;
+        }
+        result.map_times.record(std::chrono::system_clock::now() - start_time);
+
+        return true;
+    }
+
+    // give a store that spills to disk a memory budget and the job's codec
+    // and counters, a store with arenas the job's arena counters, and any
+    // store the job's partitioner
+    void configure_store(intermediate_store_type &store, size_t const memory_budget)
+    {
+        configure_spill(store, memory_budget, std::integral_constant<bool, detail::has_configure_spill<IntermediateStore>::value>());
+        configure_arenas(store, std::integral_constant<bool, detail::has_arenas<IntermediateStore>::value>());
+        if (set_partitioner_)
+            set_partitioner_(store);
+    }
+
+    void configure_spill(intermediate_store_type &store, size_t const memory_budget, std::true_type)
+    {
+        detail::spill_settings const settings = {
+            memory_budget,
+            specification_.spill_compression,
+            &spill_counters_ };
+        store.configure_spill(settings);
+    }
+
+    void configure_spill(intermediate_store_type &, size_t const, std::false_type)
+    {
+    }
+
+    // the map threads fill a store of map output each at the same time, so
+    // they divide the budget between them, one share for each hardware
+    // thread, which is how many map threads the schedule policies run by
+    // default. the job's store, which takes their values in the shuffle,
+    // has the whole budget, and holds little until the map output is merged
+    // into it
+    size_t const map_store_budget() const
+    {
+        size_t const budget = specification_.spill_memory_budget;
+        if (budget == 0)
+            return 0;
+        return std::max<size_t>(1, budget / std::max(1U, std::thread::hardware_concurrency()));
+    }
+
+    void configure_arenas(intermediate_store_type &store, std::true_type)
+    {
+        store.arena_counters(&arena_counters_);
+    }
+
+    void configure_arenas(intermediate_store_type &, std::false_type)
+    {
+    }
+
+    // the arenas of the map workers' stores have been merged into the job's
+    void report_arenas(results &result, std::true_type)
+    {
+        intermediate_store_.report_arenas();
+        result.counters.arena_allocations_avoided = arena_counters_.allocations - arena_counters_.upstream_allocations;
+        result.counters.arena_peak_bytes          = arena_counters_.peak_bytes;
+    }
+
+    void report_arenas(results &, std::false_type)
+    {
+    }
+
+    template<typename PartitionFn>
+    void add_spread_keys(PartitionFn const &fn, std::true_type)
+    {
+        for (auto const &spread : fn.spread_keys())
+        {
+            spread_key_t &info = spread_keys_[spread.key];
+            info.first = spread.first;
+            info.count = spread.count;
+        }
+    }
+
+    template<typename PartitionFn>
+    void add_spread_keys(PartitionFn const &, std::false_type)
+    {
+    }
+
+    // a result of a spread key is kept as a partial result until the
+    // second level merge; returns false for other keys
+    bool const add_partial_result(typename reduce_task_type::key_type   const &key,
+                                  typename reduce_task_type::value_type const &value)
+    {
+        if (spread_keys_.empty())
+            return false;
+
+        auto it = spread_keys_.find(key);
+        if (it == spread_keys_.end())
+            return false;
+
+        std::lock_guard<std::mutex> lock(spread_keys_mutex_);
+        it->second.partials.push_back(value);
+        return true;
+    }
+
+    // called as each reduce task of a partition finishes; the last task of
+    // the partitions of a spread key merges its partial results
+    void merge_spread_keys(size_t const partition, reduce_task_runner &runner, results &result)
+    {
+        for (auto &spread : spread_keys_)
+        {
+            if (!spread.second.spans(partition))
+                continue;
+
+            std::vector<typename reduce_task_type::value_type> partials;
+            {
+                std::lock_guard<std::mutex> lock(spread_keys_mutex_);
+                if (--spread.second.remaining > 0)
+                    continue;
+                std::swap(partials, spread.second.partials);
+            }
+
+            if (!partials.empty())
+            {
+                auto const lock = detail::lock_timed(reduce_output_mutex_, result.lock_wait_time, tracer_);
+                runner.merge_spread_key(spread.first, partials);
+            }
+        }
+    }
+
   private:
+    typedef std::vector<std::unique_ptr<map_worker>> map_workers_t;
+
+    // a key that the partitioner spreads over the partitions [first, first+count)
+    struct spread_key_t
+    {
+        bool const spans(size_t const partition) const
+        {
+            return partition >= first  &&  partition < first + count;
+        }
+
+        size_t                                             first     = 0;
+        size_t                                             count     = 0;
+        size_t                                             remaining = 0;   // reduce tasks not yet finished
+        std::vector<typename reduce_task_type::value_type> partials;
+    };
+
+    typedef
+    std::map<typename reduce_task_type::key_type, spread_key_t>
+    spread_keys_t;
+
     datasource_type         &datasource_;
     specification     const &specification_;
     intermediate_store_type  intermediate_store_;
+    std::mutex               map_workers_mutex_;
+    map_workers_t            map_workers_;
+    size_t                   map_workers_used_ = 0;     // by the current run
+    std::mutex               reduce_output_mutex_;
+    result_target_type      *result_target_;
+    detail::spill_counters   spill_counters_;
+    detail::arena_counters   arena_counters_;
+    combiner_type            combiner_;
+    std::atomic<uintmax_t>   combined_values_;
+    broadcast_type const    *broadcast_ = 0;
+    result_reduction_type    result_reduction_;
+    double                   result_reduction_total_ = 0.0;
+    std::function<void (intermediate_store_type &)> set_partitioner_;
+    spread_keys_t            spread_keys_;
+    std::mutex               spread_keys_mutex_;
+    mapreduce::tracer       *tracer_ = 0;
 };
 
 }   // namespace mapreduce
@@ -12,6 +12,7 @@
 #include <fstream>
 #include <iostream>
 #include <boost/filesystem.hpp>
+#include "intermediates/records.hpp"
 
 #ifdef __GNUC__
 #include <cstring> // ubuntu linux
@@ -34,56 +35,6 @@ bool const greater_2nd(T const &first, T const &second)
     return first.second > second.second;
 }
 
-template<typename It>
-bool const do_file_merge(It first, It last, std::string const &outfilename)
-{
-#ifdef _DEBUG
-    int const max_files=10;
-#endif
-
-    int count = 0;
-    std::ofstream outfile(outfilename.c_str(), std::ios_base::out | std::ios_base::binary);
-    while (first!=last)
-    {
-        //!!!subsequent times around the loop need to merge with outfilename from previous iteration
-        // in the meantime, we assert if we go round the loop more than once as it will produce incorrect results
-        assert(++count == 1);
-
-        typedef std::list<std::pair<std::shared_ptr<std::ifstream>, std::string> > file_lines_t;
-        file_lines_t file_lines;
-        for (; first!=last; ++first)
-        {
-            auto file = std::make_shared<std::ifstream>(first->c_str(), std::ios_base::in | std::ios_base::binary);
-            if (!file->is_open())
-                break;
-#ifdef _DEBUG
-            if (file_lines.size() == max_files)
-                break;
-#endif
-
-            std::string line;
-            std::getline(*file, line, '\r');
-            file_lines.push_back(std::make_pair(file, line));
-        }
-
-        while (file_lines.size() > 0)
-        {
-            typename file_lines_t::iterator it;
-            if (file_lines.size() == 1)
-                it = file_lines.begin();
-            else
-                it = std::min_element(file_lines.begin(), file_lines.end());
-            outfile << it->second << "\r";
-
-            std::getline(*it->first, it->second, '\r');
-            if (it->first->eof())
-                file_lines.erase(it);
-        }
-    }
-
-    return true;
-}
-
 inline bool const delete_file(std::string const &pathname)
 {
     if (pathname.empty())
@@ -131,6 +82,174 @@ class temporary_file_manager : detail::noncopyable
     Filenames &filenames_;
 };
 
+// A tournament tree over the current records of k sorted inputs, holding the
+// loser of each match in the internal nodes. After the winning input moves
+// on to its next record, replay() restores the tree with one comparison per
+// level, against the stored losers only. Less(i, j) compares the current
+// records of inputs i and j, and must order an exhausted input after every
+// other.
+template<typename Less>
+class loser_tree
+{
+  public:
+    loser_tree(size_t const leaves, Less const &less)
+      : less_(less),
+        leaves_(leaves),
+        tree_(std::max<size_t>(leaves, 1), 0)
+    {
+        // leaf i is node leaves+i, and node n has children 2n and 2n+1
+        std::vector<size_t> winners(2 * leaves_);
+        for (size_t leaf=0; leaf<leaves_; ++leaf)
+            winners[leaves_ + leaf] = leaf;
+
+        for (size_t node=leaves_-1; node>0  &&  node<leaves_; --node)
+        {
+            size_t const left  = winners[2 * node];
+            size_t const right = winners[2 * node + 1];
+            bool   const right_wins = less_(right, left);
+            winners[node] = right_wins? right : left;
+            tree_[node]   = right_wins? left  : right;
+        }
+        tree_[0] = (leaves_ > 1)? winners[1] : 0;
+    }
+
+    size_t const winner() const
+    {
+        return tree_[0];
+    }
+
+    // the winner's record has changed
+    void replay()
+    {
+        size_t winner = tree_[0];
+        for (size_t node=(leaves_ + winner)/2; node>0; node/=2)
+        {
+            if (less_(tree_[node], winner))
+                std::swap(tree_[node], winner);
+        }
+        tree_[0] = winner;
+    }
+
+  private:
+    Less                 less_;
+    size_t const         leaves_;
+    std::vector<size_t>  tree_;     // [0] is the winner, [1..leaves) losers
+};
+
+// External merge of sorted files of records into one sorted file. At most
+// MaxFanIn files are merged at once, through a loser_tree; with more input
+// files, groups of MaxFanIn are first merged into temporary files, in as many
+// passes as it takes. Each input is read through its own BufferSize buffer,
+// with the next block prefetched in the background. The input files are
+// deleted. All of the files are compressed by the codec, if one is given.
+template<typename RecordFormat, size_t MaxFanIn=16, size_t BufferSize=(1 << 20)>
+class file_merger
+{
+    static_assert(MaxFanIn >= 2, "a merge needs a fan-in of at least two files");
+
+  public:
+    template<typename List>
+    void operator()(List const &filenames, std::string const &dest, block_codec const *codec = 0)
+    {
+        std::deque<std::string> files(filenames.cbegin(), filenames.cend());
+        std::deque<std::string> delete_files(files);
+        temporary_file_manager<std::deque<std::string>> tfm(delete_files);
+
+        while (files.size() > MaxFanIn)
+        {
+            std::string const temp_filename = platform::get_temporary_filename();
+            delete_files.push_back(temp_filename);
+
+            merge(files.cbegin(), files.cbegin() + MaxFanIn, temp_filename, codec);
+            for (size_t loop=0; loop<MaxFanIn; ++loop)
+            {
+                delete_file(files.front());
+                files.pop_front();
+            }
+            files.push_back(temp_filename);
+        }
+        merge(files.cbegin(), files.cend(), dest, codec);
+    }
+
+  private:
+    typedef typename RecordFormat::record_type record_t;
+
+    struct input_t : noncopyable
+    {
+        input_t(std::string const &filename, block_codec const *codec)
+          : reader(filename, BufferSize, true, codec),
+            valid(false)
+        {
+        }
+
+        record_reader reader;
+        record_t      record;
+        bool          valid;    // false once the input is exhausted
+    };
+    typedef std::vector<std::unique_ptr<input_t>> inputs_t;
+
+    struct input_less
+    {
+        explicit input_less(inputs_t const &inputs) : inputs_(&inputs)
+        {
+        }
+
+        bool const operator()(size_t const first, size_t const second) const
+        {
+            input_t const &left  = *(*inputs_)[first];
+            input_t const &right = *(*inputs_)[second];
+            if (!right.valid)
+                return left.valid;
+            return left.valid  &&  left.record < right.record;
+        }
+
+      private:
+        inputs_t const *inputs_;
+    };
+
+    template<typename It>
+    static void merge(It first, It last, std::string const &dest, block_codec const *codec)
+    {
+        inputs_t inputs;
+        for (; first!=last; ++first)
+        {
+            inputs.push_back(std::unique_ptr<input_t>(new input_t(*first, codec)));
+            input_t &input = *inputs.back();
+            if (!input.reader.is_open())
+                BOOST_THROW_EXCEPTION(std::runtime_error("Unable to open file " + *first));
+            input.valid = RecordFormat::read(input.reader, input.record);
+        }
+
+        record_writer outfile(BufferSize, codec);
+        if (!outfile.open(dest))
+            BOOST_THROW_EXCEPTION(std::runtime_error("Unable to open file " + dest));
+
+        if (!inputs.empty())
+        {
+            loser_tree<input_less> tree(inputs.size(), input_less(inputs));
+            while (inputs[tree.winner()]->valid)
+            {
+                input_t &input = *inputs[tree.winner()];
+                RecordFormat::write(outfile, input.record);
+                input.valid = RecordFormat::read(input.reader, input.record);
+                tree.replay();
+            }
+        }
+
+        outfile.close();
+        if (outfile.fail())
+            BOOST_THROW_EXCEPTION(std::runtime_error("An error occurred writing the file " + dest));
+    }
+};
+
+// merge sorted files of '\r' terminated lines
+template<typename It>
+bool const do_file_merge(It first, It last, std::string const &outfilename)
+{
+    file_merger<line_records>()(std::vector<std::string>(first, last), outfilename);
+    return true;
+}
+
 }   // namespace detail
 
 template<typename T>
@@ -73,18 +73,26 @@ std::basic_string<Char> &get_temporary_filename(std::basic_string<Char> &pathnam
 }
 
 #else
+#include <cerrno>
+#include <cstdlib>
+#include <unistd.h>
 
 namespace mapreduce {
 
 namespace linux_os {
 
-std::string get_temporary_filename(std::string &pathname)
+// mkstemp creates the file, so each name is unique between threads and
+// processes; the caller overwrites or deletes it
+inline std::string &get_temporary_filename(std::string &pathname)
 {
-    const std::string tmp = "/tmp/XXXXXX";
-    char* tmpfile = const_cast<char*>(tmp.c_str());
-    //auto tmp2 = mkstemp(tmpfile);
-    std::string res(tmpfile);
-    return res;
+    char filename[] = "/tmp/mr_XXXXXX";
+    int const fd = mkstemp(filename);
+    if (fd == -1)
+        BOOST_THROW_EXCEPTION(boost::system::system_error(errno, boost::system::system_category()));
+    close(fd);
+
+    pathname = filename;
+    return pathname;
 }
 
 #endif
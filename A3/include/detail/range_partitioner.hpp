@@ -0,0 +1,288 @@
+// Copyright (c) 2009-2016 Craig Henderson
+// https://github.com/cdmh/mapreduce
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <functional>
+#include <memory>
+#include <random>
+#include <utility>
+#include <vector>
+
+namespace mapreduce {
+
+namespace detail {
+
+// the runtime of a map task run by sample_intermediate_keys; keeps a
+// uniform sample of the keys emitted
+template<typename Key>
+class key_sampler
+{
+  public:
+    explicit key_sampler(size_t const max_samples)
+      : max_samples_(max_samples),
+        seen_(0)
+    {
+    }
+
+    template<typename T, typename Value>
+    bool const emit_intermediate(T const &key, Value const &)
+    {
+        // reservoir sampling
+        if (samples_.size() < max_samples_)
+            samples_.push_back(Key(key));
+        else
+        {
+            size_t const index = std::uniform_int_distribution<size_t>(0, seen_)(random_);
+            if (index < max_samples_)
+                samples_[index] = Key(key);
+        }
+        ++seen_;
+        return true;
+    }
+
+    std::vector<Key> &samples()
+    {
+        return samples_;
+    }
+
+  private:
+    size_t const     max_samples_;
+    size_t           seen_;
+    std::minstd_rand random_;
+    std::vector<Key> samples_;
+};
+
+// a counter for a copyable object that may be used by several threads at
+// once, where the count need not be exact
+class relaxed_counter
+{
+  public:
+    relaxed_counter() : count_(0)
+    {
+    }
+
+    relaxed_counter(relaxed_counter const &other) : count_(other.count_.load(std::memory_order_relaxed))
+    {
+    }
+
+    relaxed_counter &operator=(relaxed_counter const &other)
+    {
+        count_.store(other.count_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        return *this;
+    }
+
+    size_t const next()
+    {
+        return count_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+  private:
+    std::atomic<size_t> count_;
+};
+
+}   // namespace detail
+
+// Runs the map task over at most max_map_keys keys of a datasource and
+// returns a sample of at most max_samples of the intermediate keys they
+// emit, to choose the boundaries of a range_partitioner. The datasource is
+// used up, so should not be the one that the job is then run with. Map
+// tasks that read broadcast state cannot be sampled.
+template<typename Key, typename MapTask, typename Datasource>
+std::vector<Key> sample_intermediate_keys(Datasource &datasource, size_t const max_map_keys, size_t const max_samples = 10000)
+{
+    detail::key_sampler<Key> sampler(max_samples);
+    for (size_t loop=0; loop<max_map_keys; ++loop)
+    {
+        typename MapTask::key_type key;
+        if (!datasource.setup_key(key))
+            break;
+
+        typename MapTask::value_type value;
+        if (datasource.get_data(key, value))
+            MapTask()(sampler, key, value);
+    }
+    return std::move(sampler.samples());
+}
+
+// Divides intermediate keys into partitions of consecutive key ranges, so
+// with a store that reduces each partition in key order, such as in_memory,
+// local_disk or hybrid, the output files concatenate in sorted order without
+// a final merge. The boundaries are chosen from a sample of the keys, see
+// sample_intermediate_keys, so that each partition receives about the same
+// number of values.
+//
+// A hot key, one with more than skew_threshold of the sampled values, is
+// spread over as many consecutive partitions as its share of the values
+// fills, at least two. Its values are dealt to them in turn, each reduces
+// its share to a partial result, and the job reduces the partial results in
+// a second level merge, see job::partitioner. The reduce must then be
+// associative, as for a combiner. Without a skew_threshold, keys are spread
+// only when they fill more than one partition.
+//
+// A default constructed range_partitioner puts every key in partition 0.
+template<typename Key, typename Compare = std::less<Key>>
+class range_partitioner
+{
+  public:
+    typedef Key key_type;
+
+    // a key spread over the partitions [first, first + count)
+    struct spread_key
+    {
+        Key    key;
+        size_t first;
+        size_t count;
+    };
+
+    range_partitioner() : splits_(std::make_shared<std::vector<Key>>())
+    {
+    }
+
+    range_partitioner(std::vector<Key> sample, size_t const partitions, double const skew_threshold = 0.0)
+      : splits_(std::make_shared<std::vector<Key>>())
+    {
+        choose_splits(sample, std::max<size_t>(1, partitions), skew_threshold);
+    }
+
+    // the partition of key is the number of boundaries that are before it,
+    // so a partition holds the keys after the previous boundary up to and
+    // including its own. a hot key is the boundary of each of its partitions
+    size_t const operator()(Key const &key, size_t const partitions) const
+    {
+        Compare const compare;
+        auto const lower = std::lower_bound(splits_->cbegin(), splits_->cend(), key, compare);
+        size_t partition = lower - splits_->cbegin();
+        if (lower != splits_->cend()  &&  !compare(key, *lower))
+        {
+            auto const upper = std::upper_bound(lower, splits_->cend(), key, compare);
+            size_t const count = upper - lower;
+            if (count > 1)
+                partition += next_.next() % count;
+        }
+        return std::min(partition, partitions - 1);
+    }
+
+    std::vector<Key> const &splits() const
+    {
+        return *splits_;
+    }
+
+    std::vector<spread_key> spread_keys() const
+    {
+        Compare const compare;
+        std::vector<spread_key> spread;
+        for (auto it=splits_->cbegin(); it!=splits_->cend(); )
+        {
+            auto const upper = std::upper_bound(it, splits_->cend(), *it, compare);
+            if (upper - it > 1)
+                spread.push_back(spread_key{*it, size_t(it - splits_->cbegin()), size_t(upper - it)});
+            it = upper;
+        }
+        return spread;
+    }
+
+  private:
+    // the boundaries of the cold keys are spaced evenly through their share
+    // of the sample; a hot key is the boundary of `share` partitions
+    void choose_splits(std::vector<Key> &sample, size_t const partitions, double skew_threshold)
+    {
+        Compare const compare;
+        std::sort(sample.begin(), sample.end(), compare);
+        if (sample.empty()  ||  partitions == 1)
+            return;
+
+        double const per_partition = double(sample.size()) / partitions;
+        if (skew_threshold <= 0.0)
+            skew_threshold = 1.0 / partitions;
+
+        // runs of equal keys
+        std::vector<std::pair<size_t, size_t>> runs;     // first sample, number of samples
+        for (size_t first=0; first<sample.size(); )
+        {
+            size_t last = first + 1;
+            while (last < sample.size()  &&  !compare(sample[first], sample[last]))
+                ++last;
+            runs.push_back(std::make_pair(first, last - first));
+            first = last;
+        }
+
+        std::vector<size_t> shares(runs.size(), 0);
+        size_t hot_partitions = 0;
+        size_t hot_samples    = 0;
+        for (size_t loop=0; loop<runs.size(); ++loop)
+        {
+            size_t const share = std::min(partitions - 1, std::max<size_t>(2, size_t(std::lround(runs[loop].second / per_partition))));
+            if (runs[loop].second > skew_threshold * sample.size()  &&  share > 1)
+            {
+                shares[loop]    = share;
+                hot_partitions += share;
+                hot_samples    += runs[loop].second;
+            }
+        }
+
+        // take partitions back from the hot keys with the most until there
+        // are some left for the others
+        while (hot_partitions >= partitions)
+        {
+            size_t const largest = std::max_element(shares.begin(), shares.end()) - shares.begin();
+            --shares[largest];
+            --hot_partitions;
+            if (shares[largest] == 1)
+            {
+                // no longer spread
+                shares[largest] = 0;
+                --hot_partitions;
+                hot_samples -= runs[largest].second;
+            }
+        }
+
+        size_t const cold_partitions = partitions - hot_partitions;
+        double const per_cold        = double(sample.size() - hot_samples) / cold_partitions;
+        double       cold_samples    = 0;
+        size_t       cold_splits     = 0;
+        for (size_t loop=0; loop<runs.size()  &&  splits_->size()+1<partitions; ++loop)
+        {
+            Key const &key = sample[runs[loop].first];
+            if (shares[loop] > 1)
+            {
+                splits_->insert(splits_->end(), std::min(shares[loop], partitions - 1 - splits_->size()), key);
+                continue;
+            }
+
+            cold_samples += runs[loop].second;
+            if (cold_splits+1 < cold_partitions  &&  cold_samples >= per_cold * (cold_splits+1))
+            {
+                splits_->push_back(key);
+                ++cold_splits;
+            }
+        }
+    }
+
+  private:
+    std::shared_ptr<std::vector<Key>> splits_;      // shared by the copies given to the stores
+    mutable detail::relaxed_counter   next_;        // deals the values of hot keys
+};
+
+}   // namespace mapreduce
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
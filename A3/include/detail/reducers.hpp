@@ -0,0 +1,117 @@
+// Copyright (c) 2009-2016 Craig Henderson
+// https://github.com/cdmh/mapreduce
+
+#pragma once
+
+#include <iterator>
+#include <numeric>
+
+namespace mapreduce {
+
+namespace detail {
+
+// fold a contiguous range into four interleaved partial results, which the
+// compiler can keep in one vector register, and then fold the four. each
+// partial result starts at init, so op must be associative and commutative
+// and init an identity of it (or, as for min and max, idempotent). floating
+// point sums are reordered, so may differ in the last bits from a loop
+template<typename T, typename Op>
+T const fold_values(T const *first, T const *last, T const &init, Op op)
+{
+    T partial[4] = { init, init, init, init };
+    size_t const count = size_t(last - first);
+    size_t index = 0;
+    for (; index+4<=count; index+=4)
+    {
+        partial[0] = op(partial[0], first[index]);
+        partial[1] = op(partial[1], first[index+1]);
+        partial[2] = op(partial[2], first[index+2]);
+        partial[3] = op(partial[3], first[index+3]);
+    }
+    for (; index<count; ++index)
+        partial[0] = op(partial[0], first[index]);
+
+    return op(op(partial[0], partial[1]), op(partial[2], partial[3]));
+}
+
+// values from a store that does not hold them contiguously
+template<typename It, typename T, typename Op>
+T const fold_values(It first, It last, T const &init, Op op)
+{
+    return std::accumulate(first, last, init, op);
+}
+
+}   // namespace detail
+
+// Reduce tasks for common aggregations, that a job can name as its
+// ReduceTask rather than writing one, for example
+//     mapreduce::job<map_task, mapreduce::reducers::sum<std::string, unsigned>>
+// Each emits one value for each key. They are also associative, so can be
+// used where a partial reduce is made, see schedule_policy::pipelined.
+namespace reducers {
+
+template<typename Key, typename Value>
+struct sum : public reduce_task<Key, Value>
+{
+    template<typename Runtime, typename It>
+    void operator()(Runtime &runtime, Key const &key, It first, It last) const
+    {
+        runtime.emit(key, detail::fold_values(first, last, Value(), detail::add_values()));
+    }
+};
+
+template<typename Key, typename Value>
+struct min : public reduce_task<Key, Value>
+{
+    template<typename Runtime, typename It>
+    void operator()(Runtime &runtime, Key const &key, It first, It last) const
+    {
+        if (first != last)
+            runtime.emit(key, detail::fold_values(first, last, Value(*first), detail::min_value()));
+    }
+};
+
+template<typename Key, typename Value>
+struct max : public reduce_task<Key, Value>
+{
+    template<typename Runtime, typename It>
+    void operator()(Runtime &runtime, Key const &key, It first, It last) const
+    {
+        if (first != last)
+            runtime.emit(key, detail::fold_values(first, last, Value(*first), detail::max_value()));
+    }
+};
+
+// the number of values of each key; unlike the others, this is not
+// associative, as a partial count is itself only one value
+template<typename Key, typename Value>
+struct count : public reduce_task<Key, Value>
+{
+    template<typename Runtime, typename It>
+    void operator()(Runtime &runtime, Key const &key, It first, It last) const
+    {
+        runtime.emit(key, Value(std::distance(first, last)));
+    }
+};
+
+}   // namespace reducers
+
+}   // namespace mapreduce
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
@@ -3,6 +3,9 @@
 
 #include "schedule_policy/sequential.hpp"
 #include "schedule_policy/cpu_parallel.hpp"
+#include "schedule_policy/pooled.hpp"
+#include "schedule_policy/work_stealing.hpp"
+#include "schedule_policy/pipelined.hpp"
 
 // Permission is hereby granted, free of charge, to any person obtaining a copy
 // of this software and associated documentation files (the "Software"), to deal
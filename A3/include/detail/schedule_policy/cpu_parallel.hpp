@@ -11,23 +11,60 @@ namespace schedule_policy {
 
 namespace detail {
 
+// claim blocks of keys from the datasource, no lock and no allocation per key
+template<typename Job, typename RunMapKey>
+inline void for_each_map_key(Job &job, std::mutex &/*m1*/, RunMapKey &run_map_key, std::true_type)
+{
+    std::vector<typename Job::map_task_type::key_type> keys(job.map_key_batch_size());
+    while (size_t const count = job.get_next_map_keys(keys.data(), keys.size()))
+    {
+        mapreduce::tracer::scope trace(job.tracer(), "map keys", "keys", count);
+        for (size_t loop=0; loop<count; ++loop)
+            run_map_key(keys[loop]);
+    }
+}
+
+// one key at a time, under the lock
+template<typename Job, typename RunMapKey>
+inline void for_each_map_key(Job &job, std::mutex &m1, RunMapKey &run_map_key, std::false_type)
+{
+    bool run = true;
+    while (run)
+    {
+        typename Job::map_task_type::key_type *key = 0;
+
+        m1.lock();
+        run = job.get_next_map_key(key);
+        m1.unlock();
+
+        if (run)
+        {
+            std::unique_ptr<typename Job::map_task_type::key_type> map_key(key);
+            mapreduce::tracer::scope trace(job.tracer(), "map keys", "keys", 1);
+            run_map_key(*map_key);
+        }
+    }
+}
+
 template<typename Job>
 inline void run_next_map_task(Job &job, std::mutex &m1, std::mutex &m2, results &result)
 {
     try
     {
-        bool run = true;
-        while (run)
-        {
-            typename Job::map_task_type::key_type *key = 0;
-
-            m1.lock();
-            run = job.get_next_map_key(key);
-            m1.unlock();
+        typename Job::map_worker *worker = 0;
+        if (job.per_thread_map_output())
+            worker = &job.make_map_worker();
 
-            if (run)
+        auto run_map_key = [&job, &m2, &result, worker](typename Job::map_task_type::key_type &key) {
+            if (worker)
+                job.run_map_task(key, result, *worker);
+            else
                 job.run_map_task(key, result, m2);
-        }
+        };
+        for_each_map_key(job, m1, run_map_key, std::integral_constant<bool, Job::batched_map_keys>());
+
+        if (worker)
+            job.finish_map_worker(*worker);
     }
     catch (std::exception &e)
     {
@@ -63,13 +100,24 @@ inline void run_next_reduce_task(Job &job, size_t &partition, std::mutex &mutex,
 }
 
 template<typename Job>
-void run_intermediate_results_shuffle(Job &job, size_t const partition, results &result)
+void run_next_intermediate_results_shuffle(Job &job, size_t &partition, std::mutex &mutex, results &result)
 {
     try
     {
-        auto const start_time = std::chrono::system_clock::now();
-        job.run_intermediate_results_shuffle(partition);
-        result.shuffle_times.push_back(std::chrono::system_clock::now() - start_time);
+        while (1)
+        {
+            size_t part;
+            {
+                std::lock_guard<std::mutex> guard(mutex);
+                part = partition++;
+            }
+            if (part >= job.number_of_partitions())
+                break;
+
+            auto const start_time = std::chrono::system_clock::now();
+            job.run_intermediate_results_shuffle(part);
+            result.shuffle_times.record(std::chrono::system_clock::now() - start_time);
+        }
     }
     catch (std::exception &e)
     {
@@ -77,6 +125,39 @@ void run_intermediate_results_shuffle(Job &job, size_t const partition, results
     }
 }
 
+inline void add_partition_counts(std::vector<uintmax_t> &total, std::vector<uintmax_t> const &counts)
+{
+    if (total.size() < counts.size())
+        total.resize(counts.size());
+    for (size_t partition=0; partition<counts.size(); ++partition)
+        total[partition] += counts[partition];
+}
+
+// we're done with the map/reduce job, collate the statistics before returning
+template<typename AllResults>
+void collate_results(AllResults const &all_results, results &result)
+{
+    for (auto it=all_results.cbegin(); it!=all_results.cend(); ++it)
+    {
+        result.counters.map_keys_executed     += (*it)->counters.map_keys_executed;
+        result.counters.map_key_errors        += (*it)->counters.map_key_errors;
+        result.counters.map_keys_completed    += (*it)->counters.map_keys_completed;
+        result.counters.reduce_keys_executed  += (*it)->counters.reduce_keys_executed;
+        result.counters.reduce_key_errors     += (*it)->counters.reduce_key_errors;
+        result.counters.reduce_keys_completed += (*it)->counters.reduce_keys_completed;
+        result.counters.emitted_values        += (*it)->counters.emitted_values;
+        result.counters.emitted_bytes         += (*it)->counters.emitted_bytes;
+
+        result.map_times.merge((*it)->map_times);
+        result.shuffle_times.merge((*it)->shuffle_times);
+        result.reduce_times.merge((*it)->reduce_times);
+        result.lock_wait_time += (*it)->lock_wait_time;
+
+        add_partition_counts(result.partition_keys,   (*it)->partition_keys);
+        add_partition_counts(result.partition_values, (*it)->partition_values);
+    }
+}
+
 }   // namespace detail
 
 
@@ -90,6 +171,7 @@ class cpu_parallel : mapreduce::detail::noncopyable
 
     void operator()(Job &job, results &result)
     {
+        all_results_.clear();
         map(job, result);
         intermediate(job, result);
         reduce(job, result);
@@ -130,24 +212,25 @@ class cpu_parallel : mapreduce::detail::noncopyable
         // Intermediate results shuffle
         auto const start_time = std::chrono::system_clock::now();
 
+        // each thread takes the next unshuffled partition until none remain
+        std::mutex m1;
+        size_t     partition      = 0;
+        auto const shuffle_tasks  = std::min(size_t(num_cpus_), job.number_of_partitions());
+
         mapreduce::detail::joined_thread_group shuffle_threads;
-        for (size_t partition=0; partition<job.number_of_partitions(); ++partition)
+        for (size_t loop=0; loop<shuffle_tasks; ++loop)
         {
-            for (size_t loop=0;
-                 loop<size_t(num_cpus_)  &&  partition<job.number_of_partitions();
-                 ++loop, ++partition)
-            {
-                auto this_result = std::make_shared<results>();
-                all_results_.push_back(this_result);
-
-                shuffle_threads.emplace_back(
-                    std::thread(
-                        std::bind(
-                            &detail::run_intermediate_results_shuffle<Job>,
-                            std::ref(job),
-                            partition,
-                            std::ref(*this_result))));
-            }
+            auto this_result = std::make_shared<results>();
+            all_results_.push_back(this_result);
+
+            shuffle_threads.emplace_back(
+                std::thread(
+                    std::bind(
+                        &detail::run_next_intermediate_results_shuffle<Job>,
+                        std::ref(job),
+                        std::ref(partition),
+                        std::ref(m1),
+                        std::ref(*this_result))));
         }
         shuffle_threads.join_all();
         result.shuffle_runtime = std::chrono::system_clock::now() - start_time;
@@ -184,29 +267,7 @@ class cpu_parallel : mapreduce::detail::noncopyable
 
     void collate_results(results &result)
     {
-        // we're done with the map/reduce job, collate the statistics before returning
-        for (auto it=all_results_.cbegin(); it!=all_results_.cend(); ++it)
-        {
-            result.counters.map_keys_executed     += (*it)->counters.map_keys_executed;
-            result.counters.map_key_errors        += (*it)->counters.map_key_errors;
-            result.counters.map_keys_completed    += (*it)->counters.map_keys_completed;
-            result.counters.reduce_keys_executed  += (*it)->counters.reduce_keys_executed;
-            result.counters.reduce_key_errors     += (*it)->counters.reduce_key_errors;
-            result.counters.reduce_keys_completed += (*it)->counters.reduce_keys_completed;
-
-            std::copy(
-                (*it)->map_times.cbegin(),
-                (*it)->map_times.cend(),
-                std::back_inserter(result.map_times));
-            std::copy(
-                (*it)->shuffle_times.cbegin(),
-                (*it)->shuffle_times.cend(),
-                std::back_inserter(result.shuffle_times));
-            std::copy(
-                (*it)->reduce_times.cbegin(),
-                (*it)->reduce_times.cend(),
-                std::back_inserter(result.reduce_times));
-        }
+        detail::collate_results(all_results_, result);
     }
 
   private:
@@ -0,0 +1,312 @@
+// Copyright (c) 2009-2016 Craig Henderson
+// https://github.com/cdmh/mapreduce
+
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <mutex>
+
+namespace mapreduce {
+
+namespace schedule_policy {
+
+namespace detail {
+
+// a queue that refuses new items once it holds `capacity` of them
+template<typename T>
+class bounded_queue : mapreduce::detail::noncopyable
+{
+  public:
+    explicit bounded_queue(size_t const capacity) : capacity_(capacity)
+    {
+    }
+
+    bool const try_push(T &item)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (items_.size() >= capacity_)
+            return false;
+        items_.push_back(std::move(item));
+        return true;
+    }
+
+    bool const try_pop(T &item)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (items_.empty())
+            return false;
+        item = std::move(items_.front());
+        items_.pop_front();
+        return true;
+    }
+
+  private:
+    size_t const  capacity_;
+    std::mutex    mutex_;
+    std::deque<T> items_;
+};
+
+}   // namespace detail
+
+// Overlaps the shuffle with the map phase, for jobs whose reduce function
+// is associative. Each map thread keeps its own intermediate store, and once
+// a partition of it holds specification::pipeline_buffer_keys keys the
+// partition is moved into a buffer and queued for that partition. Queued
+// buffers are reduced into the job's intermediate values of the partition
+// by whichever map thread finds the partition free, and a map thread that
+// finds the queue full (pipeline_queue_length buffers) waits and reduces
+// them itself, so fast mappers cannot run far ahead of the reduce. Reduced
+// buffers are kept on a free list of their partition for the next hand-on,
+// so a buffer, and its arenas, is made only when the list is empty. When the
+// map phase ends the remaining output is flushed through the queues, and the
+// reduce phase runs over the partially reduced values.
+//
+// The intermediate store must support split_partition, see
+// mapreduce::detail::has_split_partition, and insert(partition, key, value),
+// which keeps the partial results of a partition in that partition when the
+// partitioner spreads a key over several, as range_partitioner does.
+template<typename Job>
+class pipelined : mapreduce::detail::noncopyable
+{
+  public:
+    pipelined()
+      : own_pool_(new thread_pool),
+        pool_(*own_pool_)
+    {
+    }
+
+    explicit pipelined(thread_pool &pool)
+      : pool_(pool)
+    {
+    }
+
+    void operator()(Job &job, results &result)
+    {
+        all_results_.clear();
+        static_assert(Job::splittable_partitions, "pipelined requires an intermediate store that reports the size of its partitions");
+
+        queues_.clear();
+        free_buffers_.clear();
+        partitions_.reset(new partition_t[job.number_of_partitions()]);
+        for (size_t loop=0; loop<job.number_of_partitions(); ++loop)
+        {
+            queues_.push_back(std::unique_ptr<queue_t>(new queue_t(job.pipeline_queue_length())));
+
+            // each buffer of a partition is queued or held by a thread, so
+            // the free list never needs to hold more than this
+            free_buffers_.push_back(std::unique_ptr<queue_t>(new queue_t(job.pipeline_queue_length() + pool_.size())));
+        }
+
+        map(job, result);
+        intermediate(job, result);
+
+        // the buffers' arenas report to the job's counters as they are
+        // destroyed, which must be before the job reads the counters
+        free_buffers_.clear();
+        reduce(job, result);
+        collate_results(result);
+        result.counters.num_result_files = job.number_of_partitions();
+    }
+
+  private:
+    typedef typename Job::intermediate_store_type store_t;
+    typedef std::unique_ptr<store_t>              buffer_t;
+    typedef detail::bounded_queue<buffer_t>       queue_t;
+
+    struct partition_t
+    {
+        partition_t() : buffers_combined(0)
+        {
+        }
+
+        std::mutex mutex;               // held while the partition's queue is reduced
+        size_t     buffers_combined;
+    };
+
+    void map(Job &job, results &result)
+    {
+        auto const start_time = std::chrono::system_clock::now();
+
+        std::mutex m1;
+        all_results_t map_results = make_results();
+        pool_.run([this, &job, &m1, &map_results](size_t const index) {
+            try
+            {
+                results                  &this_result = *map_results[index];
+                typename Job::map_worker &worker      = job.make_map_worker();
+
+                auto run_map_key = [this, &job, &this_result, &worker](typename Job::map_task_type::key_type &key) {
+                    job.run_map_task(key, this_result, worker);
+                    hand_on_full_partitions(job, worker, this_result, job.pipeline_buffer_keys());
+                };
+                detail::for_each_map_key(job, m1, run_map_key, std::integral_constant<bool, Job::batched_map_keys>());
+
+                // final flush of the thread's map output
+                job.finish_map_worker(worker);
+                hand_on_full_partitions(job, worker, this_result, 1);
+            }
+            catch (std::exception &e)
+            {
+                std::cerr << "\nError: " << e.what() << "\n";
+            }
+        });
+
+        result.map_runtime = std::chrono::system_clock::now() - start_time;
+        result.counters.actual_map_tasks = pool_.size();
+    }
+
+    void intermediate(Job &job, results &result)
+    {
+        auto const start_time = std::chrono::system_clock::now();
+
+        std::mutex m1;
+        size_t     partition = 0;
+        all_results_t shuffle_results = make_results();
+        pool_.run([this, &job, &m1, &partition, &shuffle_results](size_t const index) {
+            try
+            {
+                while (1)
+                {
+                    size_t part;
+                    {
+                        std::lock_guard<std::mutex> guard(m1);
+                        part = partition++;
+                    }
+                    if (part >= job.number_of_partitions())
+                        break;
+
+                    combine_queued(job, part, *shuffle_results[index], true);
+                    job.run_intermediate_results_shuffle(part);
+                }
+            }
+            catch (std::exception &e)
+            {
+                std::cerr << "\nError: " << e.what() << "\n";
+            }
+        });
+
+        result.shuffle_runtime = std::chrono::system_clock::now() - start_time;
+    }
+
+    void reduce(Job &job, results &result)
+    {
+        auto const start_time = std::chrono::system_clock::now();
+
+        std::mutex m1;
+        size_t     partition = 0;
+        all_results_t reduce_results = make_results();
+        pool_.run([&job, &m1, &partition, &reduce_results](size_t const index) {
+            detail::run_next_reduce_task(job, partition, m1, *reduce_results[index]);
+        });
+
+        result.reduce_runtime = std::chrono::system_clock::now() - start_time;
+        result.counters.actual_reduce_tasks = std::min(pool_.size(), job.number_of_partitions());
+    }
+
+    void collate_results(results &result)
+    {
+        detail::collate_results(all_results_, result);
+    }
+
+    // move every partition of the worker's store that holds at least
+    // min_keys keys into a buffer, and queue it
+    void hand_on_full_partitions(Job &job, typename Job::map_worker &worker, results &result, size_t const min_keys)
+    {
+        store_t &store = worker.intermediate_store();
+        for (size_t partition=0; partition<job.number_of_partitions(); ++partition)
+        {
+            if (store.partition_key_count(partition) < min_keys)
+                continue;
+
+            buffer_t buffer;
+            if (!free_buffers_[partition]->try_pop(buffer))
+            {
+                buffer.reset(new store_t(job.number_of_partitions()));
+                job.configure_store(*buffer);
+            }
+            buffer->merge_from(partition, store);
+
+            // a full queue applies the backpressure: wait for the partition
+            // and reduce the queue before trying again
+            while (!queues_[partition]->try_push(buffer))
+                combine_queued(job, partition, result, true);
+            combine_queued(job, partition, result, false);
+        }
+    }
+
+    // reduce the queued buffers of a partition into the job's values, and
+    // return them to the partition's free list. if wait is false and another
+    // thread is already doing so, return at once. the job's values are
+    // compacted after every queue length of buffers
+    void combine_queued(Job &job, size_t const partition, results &result, bool const wait)
+    {
+        partition_t &part = partitions_[partition];
+        std::unique_lock<std::mutex> lock(part.mutex, std::defer_lock);
+        if (wait)
+            lock.lock();
+        else if (!lock.try_lock())
+            return;
+
+        auto const start_time = std::chrono::system_clock::now();
+        bool combined = false;
+        buffer_t buffer;
+        while (queues_[partition]->try_pop(buffer))
+        {
+            job.combine_partition(partition, *buffer);
+            if (!free_buffers_[partition]->try_push(buffer))
+                buffer.reset();
+            combined = true;
+
+            if (++part.buffers_combined % job.pipeline_queue_length() == 0)
+                job.combine_partition(partition);
+        }
+
+        if (combined)
+            result.shuffle_times.record(std::chrono::system_clock::now() - start_time);
+    }
+
+    typedef std::vector<std::shared_ptr<results> > all_results_t;
+
+    // one results object per worker, kept for the final collation
+    all_results_t make_results()
+    {
+        all_results_t phase_results;
+        for (size_t loop=0; loop<pool_.size(); ++loop)
+        {
+            phase_results.push_back(std::make_shared<results>());
+            all_results_.push_back(phase_results.back());
+        }
+        return phase_results;
+    }
+
+  private:
+    std::unique_ptr<thread_pool>           own_pool_;
+    thread_pool                           &pool_;
+    all_results_t                          all_results_;
+    std::vector<std::unique_ptr<queue_t>>  queues_;
+    std::vector<std::unique_ptr<queue_t>>  free_buffers_;   // reduced buffers, empty, of each partition
+    std::unique_ptr<partition_t[]>         partitions_;
+};
+
+}   // namespace schedule_policy
+
+}   // namespace mapreduce
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
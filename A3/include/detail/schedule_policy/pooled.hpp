@@ -0,0 +1,123 @@
+// Copyright (c) 2009-2016 Craig Henderson
+// https://github.com/cdmh/mapreduce
+
+#pragma once
+
+#include <mutex>
+
+namespace mapreduce {
+
+namespace schedule_policy {
+
+// Runs the same phases as cpu_parallel, but on the workers of a
+// thread_pool that outlives the job, so repeated jobs do not create threads:
+//
+//     mapreduce::thread_pool pool;
+//     job.run<mapreduce::schedule_policy::pooled<job_type> >(pool, result);
+template<typename Job>
+class pooled : mapreduce::detail::noncopyable
+{
+  public:
+    explicit pooled(thread_pool &pool) : pool_(pool)
+    {
+    }
+
+    void operator()(Job &job, results &result)
+    {
+        all_results_.clear();
+        map(job, result);
+        intermediate(job, result);
+        reduce(job, result);
+        collate_results(result);
+        result.counters.num_result_files = job.number_of_partitions();
+    }
+
+  private:
+    void map(Job &job, results &result)
+    {
+        auto const start_time = std::chrono::system_clock::now();
+
+        std::mutex m1, m2;
+        all_results_t map_results = make_results();
+        pool_.run([&job, &m1, &m2, &map_results](size_t const index) {
+            detail::run_next_map_task(job, m1, m2, *map_results[index]);
+        });
+
+        result.map_runtime = std::chrono::system_clock::now() - start_time;
+        result.counters.actual_map_tasks = pool_.size();
+    }
+
+    void intermediate(Job &job, results &result)
+    {
+        auto const start_time = std::chrono::system_clock::now();
+
+        std::mutex m1;
+        size_t     partition = 0;
+        all_results_t shuffle_results = make_results();
+        pool_.run([&job, &m1, &partition, &shuffle_results](size_t const index) {
+            detail::run_next_intermediate_results_shuffle(job, partition, m1, *shuffle_results[index]);
+        });
+
+        result.shuffle_runtime = std::chrono::system_clock::now() - start_time;
+    }
+
+    void reduce(Job &job, results &result)
+    {
+        auto const start_time = std::chrono::system_clock::now();
+
+        std::mutex m1;
+        size_t     partition = 0;
+        all_results_t reduce_results = make_results();
+        pool_.run([&job, &m1, &partition, &reduce_results](size_t const index) {
+            detail::run_next_reduce_task(job, partition, m1, *reduce_results[index]);
+        });
+
+        result.reduce_runtime = std::chrono::system_clock::now() - start_time;
+        result.counters.actual_reduce_tasks = std::min(pool_.size(), job.number_of_partitions());
+    }
+
+    void collate_results(results &result)
+    {
+        detail::collate_results(all_results_, result);
+    }
+
+    typedef std::vector<std::shared_ptr<results> > all_results_t;
+
+    // one results object per worker, kept for the final collation
+    all_results_t make_results()
+    {
+        all_results_t phase_results;
+        for (size_t loop=0; loop<pool_.size(); ++loop)
+        {
+            phase_results.push_back(std::make_shared<results>());
+            all_results_.push_back(phase_results.back());
+        }
+        return phase_results;
+    }
+
+  private:
+    thread_pool   &pool_;
+    all_results_t  all_results_;
+};
+
+}   // namespace schedule_policy
+
+}   // namespace mapreduce
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
@@ -11,8 +11,9 @@ namespace detail {
 
 struct null_lock
 {
-    void lock(void)   { }
-    void unlock(void) { }
+    void lock(void)     { }
+    void unlock(void)   { }
+    bool try_lock(void) { return true; }
 };
 
 }   // namespace detail
@@ -36,11 +37,22 @@ class sequential
     void map(Job &job, results &result)
     {
         auto const start_time(std::chrono::system_clock::now());
+        mapreduce::tracer::scope trace(job.tracer(), "map keys");
 
         typename Job::map_task_type::key_type *key = 0;
-        detail::null_lock nolock;
-        while (job.get_next_map_key(key)  &&  job.run_map_task(key, result, nolock))
-            ;
+        if (job.per_thread_map_output())
+        {
+            auto &worker = job.make_map_worker();
+            while (job.get_next_map_key(key)  &&  job.run_map_task(key, result, worker))
+                ;
+            job.finish_map_worker(worker);
+        }
+        else
+        {
+            detail::null_lock nolock;
+            while (job.get_next_map_key(key)  &&  job.run_map_task(key, result, nolock))
+                ;
+        }
         result.map_runtime = std::chrono::system_clock::now() - start_time;
     }
 
@@ -0,0 +1,398 @@
+// Copyright (c) 2009-2016 Craig Henderson
+// https://github.com/cdmh/mapreduce
+
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace mapreduce {
+
+namespace schedule_policy {
+
+namespace detail {
+
+// tasks owned by one worker. the owner pushes and pops at the back, an idle
+// worker steals the older half from the front
+template<typename T>
+class work_deque : mapreduce::detail::noncopyable
+{
+  public:
+    work_deque()
+    {
+    }
+
+    void push_back(T const &task)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        tasks_.push_back(task);
+    }
+
+    bool const pop_back(T &task)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (tasks_.empty())
+            return false;
+        task = tasks_.back();
+        tasks_.pop_back();
+        return true;
+    }
+
+    // move half of the tasks, and at least one, to the thief's deque
+    bool const steal_into(work_deque &thief)
+    {
+        std::vector<T> stolen;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            size_t const count = (tasks_.size() + 1) / 2;
+            stolen.assign(tasks_.begin(), tasks_.begin() + count);
+            tasks_.erase(tasks_.begin(), tasks_.begin() + count);
+        }
+
+        if (stolen.empty())
+            return false;
+
+        std::lock_guard<std::mutex> lock(thief.mutex_);
+        thief.tasks_.insert(thief.tasks_.end(), stolen.begin(), stolen.end());
+        return true;
+    }
+
+  private:
+    std::mutex    mutex_;
+    std::deque<T> tasks_;
+};
+
+}   // namespace detail
+
+// Each worker of a thread_pool keeps its own deque of work: blocks of map
+// keys claimed from the datasource in the map phase, and pieces of
+// partitions in the reduce phase. A worker that runs out of work steals half
+// of another worker's deque, so a hot partition or a run of expensive map
+// keys is spread over the pool. Partitions are divided into pieces only if
+// the intermediate store supports it (see detail::has_split_partition),
+// otherwise whole partitions are the unit of work.
+//
+// results::worker_busy_times and worker_idle_times hold, for each worker,
+// the time it spent working and the time it waited for the rest of the pool
+// over the map and reduce phases.
+template<typename Job>
+class work_stealing : mapreduce::detail::noncopyable
+{
+  public:
+    work_stealing()
+      : own_pool_(new thread_pool),
+        pool_(*own_pool_)
+    {
+    }
+
+    explicit work_stealing(thread_pool &pool)
+      : pool_(pool)
+    {
+    }
+
+    void operator()(Job &job, results &result)
+    {
+        all_results_.clear();
+        busy_times_.assign(pool_.size(), std::chrono::duration<double>(0));
+        idle_times_.assign(pool_.size(), std::chrono::duration<double>(0));
+        phase_busy_times_ = busy_times_;
+
+        map(job, result);
+        intermediate(job, result);
+        reduce(job, result);
+        collate_results(result);
+        result.counters.num_result_files = job.number_of_partitions();
+    }
+
+  private:
+    typedef typename Job::map_task_type::key_type map_key_t;
+    typedef std::pair<size_t, size_t>             reduce_piece_t;   // partition, piece
+
+    static size_t const whole_partition = size_t(-1);
+
+    void map(Job &job, results &result)
+    {
+        auto const start_time = std::chrono::system_clock::now();
+
+        std::vector<std::unique_ptr<detail::work_deque<map_key_t>>> deques = make_deques<map_key_t>();
+        std::mutex          m1, m2;
+        std::atomic<bool>   exhausted(false);
+        std::atomic<size_t> claiming(0);
+        all_results_t map_results = make_results();
+
+        pool_.run([&](size_t const index) {
+            auto const worker_start = std::chrono::system_clock::now();
+            try
+            {
+                typename Job::map_worker *worker = 0;
+                if (job.per_thread_map_output())
+                    worker = &job.make_map_worker();
+
+                // the keys run from the worker's deque between claims and
+                // steals are traced as a batch
+                mapreduce::tracer *const tracer = job.tracer();
+                mapreduce::tracer::clock::time_point batch_start;
+                size_t batch_keys = 0;
+
+                map_key_t key;
+                while (1)
+                {
+                    if (deques[index]->pop_back(key))
+                    {
+                        if (tracer  &&  batch_keys++ == 0)
+                            batch_start = tracer->now();
+
+                        if (worker)
+                            job.run_map_task(key, *map_results[index], *worker);
+                        else
+                            job.run_map_task(key, *map_results[index], m2);
+                        continue;
+                    }
+
+                    if (batch_keys > 0)
+                    {
+                        tracer->record("map keys", batch_start, "keys", batch_keys);
+                        batch_keys = 0;
+                    }
+
+                    if (!exhausted)
+                    {
+                        if (claim_map_keys(job, m1, *deques[index], claiming))
+                            continue;
+                        exhausted = true;
+                    }
+
+                    if (steal(deques, index))
+                        continue;
+
+                    // a block claimed by another worker may have reached its
+                    // deque after the steal above
+                    if (claiming == 0  &&  !steal(deques, index))
+                        break;
+                    std::this_thread::yield();
+                }
+
+                if (worker)
+                    job.finish_map_worker(*worker);
+            }
+            catch (std::exception &e)
+            {
+                std::cerr << "\nError: " << e.what() << "\n";
+            }
+            busy_times_[index] += std::chrono::system_clock::now() - worker_start;
+        });
+
+        result.map_runtime = std::chrono::system_clock::now() - start_time;
+        result.counters.actual_map_tasks = pool_.size();
+        add_idle_times(result.map_runtime);
+    }
+
+    void intermediate(Job &job, results &result)
+    {
+        auto const start_time = std::chrono::system_clock::now();
+
+        std::mutex m1;
+        size_t     partition = 0;
+        all_results_t shuffle_results = make_results();
+        pool_.run([&job, &m1, &partition, &shuffle_results](size_t const index) {
+            detail::run_next_intermediate_results_shuffle(job, partition, m1, *shuffle_results[index]);
+        });
+
+        result.shuffle_runtime = std::chrono::system_clock::now() - start_time;
+    }
+
+    void reduce(Job &job, results &result)
+    {
+        auto const start_time = std::chrono::system_clock::now();
+
+        std::vector<std::unique_ptr<detail::work_deque<reduce_piece_t>>> deques = make_deques<reduce_piece_t>();
+        distribute_reduce_pieces(job, deques, std::integral_constant<bool, Job::splittable_partitions>());
+
+        all_results_t reduce_results = make_results();
+        pool_.run([&](size_t const index) {
+            auto const worker_start = std::chrono::system_clock::now();
+            try
+            {
+                // every piece is queued before the phase starts, so a worker
+                // is finished when there is nothing left to steal
+                reduce_piece_t piece;
+                while (1)
+                {
+                    if (deques[index]->pop_back(piece))
+                        run_reduce_piece(job, piece, *reduce_results[index], std::integral_constant<bool, Job::splittable_partitions>());
+                    else if (!steal(deques, index))
+                        break;
+                }
+            }
+            catch (std::exception &e)
+            {
+                std::cerr << "\nError: " << e.what() << "\n";
+            }
+            busy_times_[index] += std::chrono::system_clock::now() - worker_start;
+        });
+
+        result.reduce_runtime = std::chrono::system_clock::now() - start_time;
+        result.counters.actual_reduce_tasks = pool_.size();
+        add_idle_times(result.reduce_runtime);
+    }
+
+    void collate_results(results &result)
+    {
+        detail::collate_results(all_results_, result);
+        result.worker_busy_times = busy_times_;
+        result.worker_idle_times = idle_times_;
+    }
+
+    // claim a block of keys from the datasource into the worker's deque.
+    // claiming is non-zero while a claimed block is not yet in a deque, so a
+    // worker does not finish while keys are on their way to another
+    bool const claim_map_keys(Job &job, std::mutex &m1, detail::work_deque<map_key_t> &deque, std::atomic<size_t> &claiming)
+    {
+        ++claiming;
+        std::vector<map_key_t> keys(job.map_key_batch_size());
+        size_t const count = claim_map_keys(job, m1, keys, std::integral_constant<bool, Job::batched_map_keys>());
+        for (size_t loop=0; loop<count; ++loop)
+            deque.push_back(keys[loop]);
+        --claiming;
+        return count > 0;
+    }
+
+    size_t const claim_map_keys(Job &job, std::mutex &/*m1*/, std::vector<map_key_t> &keys, std::true_type)
+    {
+        return job.get_next_map_keys(keys.data(), keys.size());
+    }
+
+    // a datasource without setup_keys may expect get_data for a key before
+    // the next setup_key (directory_iterator does, for a file read in
+    // segments), so only one key is claimed at a time
+    size_t const claim_map_keys(Job &job, std::mutex &m1, std::vector<map_key_t> &keys, std::false_type)
+    {
+        std::lock_guard<std::mutex> lock(m1);
+
+        map_key_t *key = 0;
+        if (!job.get_next_map_key(key))
+            return 0;
+
+        std::unique_ptr<map_key_t> map_key(key);
+        keys[0] = *map_key;
+        return 1;
+    }
+
+    // divide each partition into pieces of about the same number of keys,
+    // aiming for four pieces per worker over the whole job, and deal them
+    // out to the workers in turn
+    template<typename Deques>
+    void distribute_reduce_pieces(Job &job, Deques &deques, std::true_type)
+    {
+        size_t total_keys = 0;
+        for (size_t partition=0; partition<job.number_of_partitions(); ++partition)
+            total_keys += job.partition_key_count(partition);
+
+        size_t const grain = std::max<size_t>(1, total_keys / (pool_.size() * 4));
+        size_t worker = 0;
+        for (size_t partition=0; partition<job.number_of_partitions(); ++partition)
+        {
+            size_t const keys   = job.partition_key_count(partition);
+            size_t const pieces = job.split_partition(partition, (keys + grain - 1) / grain);
+            for (size_t piece=0; piece<pieces; ++piece)
+                deques[worker++ % deques.size()]->push_back(std::make_pair(partition, piece));
+        }
+    }
+
+    template<typename Deques>
+    void distribute_reduce_pieces(Job &job, Deques &deques, std::false_type)
+    {
+        for (size_t partition=0; partition<job.number_of_partitions(); ++partition)
+            deques[partition % deques.size()]->push_back(std::make_pair(partition, size_t(whole_partition)));
+    }
+
+    void run_reduce_piece(Job &job, reduce_piece_t const &piece, results &result, std::true_type)
+    {
+        job.run_reduce_task(piece.first, piece.second, result);
+    }
+
+    void run_reduce_piece(Job &job, reduce_piece_t const &piece, results &result, std::false_type)
+    {
+        job.run_reduce_task(piece.first, result);
+    }
+
+    // try each other worker in turn, starting with the next one
+    template<typename Deques>
+    static bool const steal(Deques &deques, size_t const index)
+    {
+        for (size_t loop=1; loop<deques.size(); ++loop)
+        {
+            if (deques[(index + loop) % deques.size()]->steal_into(*deques[index]))
+                return true;
+        }
+        return false;
+    }
+
+    template<typename T>
+    std::vector<std::unique_ptr<detail::work_deque<T>>> make_deques() const
+    {
+        std::vector<std::unique_ptr<detail::work_deque<T>>> deques;
+        for (size_t loop=0; loop<pool_.size(); ++loop)
+            deques.push_back(std::unique_ptr<detail::work_deque<T>>(new detail::work_deque<T>));
+        return deques;
+    }
+
+    // busy_times_ holds the running total, so the idle time of a phase is
+    // the phase runtime less the busy time added during the phase
+    void add_idle_times(std::chrono::duration<double> const &phase_runtime)
+    {
+        for (size_t loop=0; loop<pool_.size(); ++loop)
+        {
+            auto const busy = busy_times_[loop] - phase_busy_times_[loop];
+            idle_times_[loop] += std::max(std::chrono::duration<double>(0), phase_runtime - busy);
+        }
+        phase_busy_times_ = busy_times_;
+    }
+
+    typedef std::vector<std::shared_ptr<results> > all_results_t;
+
+    // one results object per worker, kept for the final collation
+    all_results_t make_results()
+    {
+        all_results_t phase_results;
+        for (size_t loop=0; loop<pool_.size(); ++loop)
+        {
+            phase_results.push_back(std::make_shared<results>());
+            all_results_.push_back(phase_results.back());
+        }
+        return phase_results;
+    }
+
+  private:
+    std::unique_ptr<thread_pool>               own_pool_;
+    thread_pool                               &pool_;
+    all_results_t                              all_results_;
+    std::vector<std::chrono::duration<double>> busy_times_;
+    std::vector<std::chrono::duration<double>> phase_busy_times_;
+    std::vector<std::chrono::duration<double>> idle_times_;
+};
+
+}   // namespace schedule_policy
+
+}   // namespace mapreduce
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
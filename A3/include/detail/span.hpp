@@ -0,0 +1,84 @@
+// Copyright (c) 2009-2016 Craig Henderson
+// https://github.com/cdmh/mapreduce
+
+#pragma once
+
+#include <cstddef>
+#include <type_traits>
+
+namespace mapreduce {
+
+// A view of contiguous elements owned elsewhere, such as the contents of a
+// std::vector. As a map value type it lets a datasource hand a map task its
+// input without copying it, see datasource::container.
+template<typename T>
+class span
+{
+  public:
+    typedef T                                  element_type;
+    typedef typename std::remove_cv<T>::type   value_type;
+    typedef T                                 *iterator;
+    typedef T                                 *const_iterator;
+
+    span() : data_(0), size_(0)
+    {
+    }
+
+    span(T *data, size_t const size) : data_(data), size_(size)
+    {
+    }
+
+    T *data() const
+    {
+        return data_;
+    }
+
+    size_t const size() const
+    {
+        return size_;
+    }
+
+    bool const empty() const
+    {
+        return size_ == 0;
+    }
+
+    T &operator[](size_t const index) const
+    {
+        return data_[index];
+    }
+
+    iterator begin() const
+    {
+        return data_;
+    }
+
+    iterator end() const
+    {
+        return data_ + size_;
+    }
+
+  private:
+    T      *data_;
+    size_t  size_;
+};
+
+}   // namespace mapreduce
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
@@ -0,0 +1,138 @@
+// Copyright (c) 2009-2016 Craig Henderson
+// https://github.com/cdmh/mapreduce
+
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace mapreduce {
+
+// A fixed set of worker threads that is created once and then runs every
+// phase of every job it is given, see schedule_policy::pooled. run() hands
+// the same task to each worker, with the worker's index, and returns when
+// all of them have finished it.
+class thread_pool : detail::noncopyable
+{
+  public:
+    explicit thread_pool(size_t const threads      = std::max(1U, std::thread::hardware_concurrency()),
+                         bool   const pin_to_cores = false)
+      : task_(0),
+        generation_(0),
+        running_(0),
+        stop_(false)
+    {
+        for (size_t index=0; index<std::max<size_t>(1, threads); ++index)
+        {
+            workers_.emplace_back(
+                std::thread(
+                    std::bind(&thread_pool::worker, this, index)));
+
+            if (pin_to_cores)
+                pin(workers_.back(), index);
+        }
+    }
+
+    ~thread_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        start_.notify_all();
+        workers_.join_all();
+    }
+
+    size_t const size() const
+    {
+        return workers_.size();
+    }
+
+    // run task(index) on every worker and wait for them all; the task is
+    // responsible for its own exceptions
+    void run(std::function<void(size_t)> const &task)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        task_    = &task;
+        running_ = workers_.size();
+        ++generation_;
+        start_.notify_all();
+        done_.wait(lock, [this] { return running_ == 0; });
+        task_ = 0;
+    }
+
+  private:
+    void worker(size_t const index)
+    {
+        size_t generation = 0;
+        while (1)
+        {
+            std::function<void(size_t)> const *task;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                start_.wait(lock, [this, generation] { return stop_  ||  generation_ != generation; });
+                if (stop_)
+                    return;
+                generation = generation_;
+                task       = task_;
+            }
+
+            (*task)(index);
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (--running_ == 0)
+                done_.notify_one();
+        }
+    }
+
+    static void pin(std::thread &thread, size_t const index)
+    {
+#if defined(__linux__)
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(index % std::max(1U, std::thread::hardware_concurrency()), &cpus);
+        pthread_setaffinity_np(thread.native_handle(), sizeof(cpus), &cpus);
+#else
+        (void)thread;
+        (void)index;
+#endif
+    }
+
+  private:
+    std::mutex                               mutex_;
+    std::condition_variable                  start_;
+    std::condition_variable                  done_;
+    std::function<void(size_t)> const       *task_;
+    size_t                                   generation_;
+    size_t                                   running_;
+    bool                                     stop_;
+    mapreduce::detail::joined_thread_group   workers_;
+};
+
+}   // namespace mapreduce
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
@@ -0,0 +1,235 @@
+// Copyright (c) 2009-2016 Craig Henderson
+// https://github.com/cdmh/mapreduce
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace mapreduce {
+
+// A timeline of a job, written as a Chrome trace-event file that
+// chrome://tracing or https://ui.perfetto.dev opens, with a row for each
+// thread. A job given a tracer, see job::tracer, records its map key
+// batches, merges, shuffles, partition reduces and contended lock waits,
+// and writes the file at the end of each run, with the events of all of
+// the runs so far, so the iterations of an iterative_job are laid side by
+// side.
+//
+// Each thread appends to a buffer of its own, without a lock; a thread
+// takes the tracer's lock only for its first event, to find its buffer.
+// The events of a run must all be recorded before the file is written.
+class tracer : detail::noncopyable
+{
+  public:
+    typedef std::chrono::steady_clock clock;
+
+    // an interval of a thread's time, and what it was spent on
+    class scope : detail::noncopyable
+    {
+      public:
+        // a null tracer records nothing, and does not read the clock
+        scope(tracer *tracer, char const *name, char const *arg_name = 0, uint64_t const arg = 0)
+          : tracer_(tracer),
+            name_(name),
+            arg_name_(arg_name),
+            arg_(arg)
+        {
+            if (tracer_)
+                start_ = tracer_->now();
+        }
+
+        ~scope()
+        {
+            if (tracer_)
+                tracer_->record(name_, start_, arg_name_, arg_);
+        }
+
+        void arg(char const *arg_name, uint64_t const arg)
+        {
+            arg_name_ = arg_name;
+            arg_      = arg;
+        }
+
+      private:
+        tracer            *tracer_;
+        char const        *name_;
+        char const        *arg_name_;
+        uint64_t           arg_;
+        clock::time_point  start_;
+    };
+
+    // the file is written by flush(); without a filename, only by write()
+    explicit tracer(std::string const &filename = std::string())
+      : id_(++next_id()),
+        filename_(filename),
+        origin_(clock::now())
+    {
+    }
+
+    std::string const &filename() const
+    {
+        return filename_;
+    }
+
+    clock::time_point const now() const
+    {
+        return clock::now();
+    }
+
+    // an event of the calling thread from start until now. name and arg_name
+    // must outlive the tracer, so are usually string literals, and are
+    // written without escaping
+    void record(char const *name, clock::time_point const start, char const *arg_name = 0, uint64_t const arg = 0)
+    {
+        event const e = { name, arg_name, arg, start - origin_, now() - start };
+        thread_buffer().events.push_back(e);
+    }
+
+    // write the trace file, if the tracer has a filename
+    bool const flush() const
+    {
+        if (filename_.empty())
+            return true;
+
+        std::ofstream stream(filename_.c_str(), std::ios_base::out | std::ios_base::trunc);
+        write(stream);
+        return !stream.fail();
+    }
+
+    // {"traceEvents":[...],"displayTimeUnit":"ms"}; a complete ("X") event
+    // for each interval, and the name of each thread
+    void write(std::ostream &stream) const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        stream << "{\"traceEvents\":[";
+        bool first = true;
+        for (auto const &buffer : buffers_)
+        {
+            stream << (first? "\n":",\n")
+                   << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->number
+                   << ",\"args\":{\"name\":\"thread " << buffer->number << "\"}}";
+            first = false;
+
+            for (auto const &e : buffer->events)
+            {
+                stream << ",\n{\"name\":\"" << e.name
+                       << "\",\"cat\":\"mapreduce\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->number
+                       << ",\"ts\":";
+                write_microseconds(stream, e.start);
+                stream << ",\"dur\":";
+                write_microseconds(stream, e.duration);
+                if (e.arg_name)
+                    stream << ",\"args\":{\"" << e.arg_name << "\":" << e.arg << "}";
+                stream << "}";
+            }
+        }
+        stream << "\n],\"displayTimeUnit\":\"ms\"}\n";
+    }
+
+  private:
+    struct event
+    {
+        char const       *name;
+        char const       *arg_name;
+        uint64_t          arg;
+        clock::duration   start;      // since the tracer was made
+        clock::duration   duration;
+    };
+
+    struct thread_events
+    {
+        std::thread::id    thread;
+        size_t             number;    // the trace's tid
+        std::vector<event> events;
+    };
+
+    // the last tracer that the thread recorded an event with, and its buffer
+    struct thread_cache
+    {
+        uintmax_t      tracer_id;
+        thread_events *buffer;
+    };
+
+    thread_events &thread_buffer()
+    {
+        static thread_local thread_cache cache = { 0, 0 };
+        if (cache.tracer_id != id_)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto const thread = std::this_thread::get_id();
+            auto it = std::find_if(
+                buffers_.begin(),
+                buffers_.end(),
+                [thread](std::unique_ptr<thread_events> const &buffer) {
+                    return buffer->thread == thread;
+                });
+
+            if (it == buffers_.end())
+            {
+                std::unique_ptr<thread_events> buffer(new thread_events);
+                buffer->thread = thread;
+                buffer->number = buffers_.size() + 1;
+                buffers_.push_back(std::move(buffer));
+                it = buffers_.end() - 1;
+            }
+
+            cache.tracer_id = id_;
+            cache.buffer    = it->get();
+        }
+        return *cache.buffer;
+    }
+
+    // to the nanosecond, however long the trace, where a double would be
+    // written to six significant digits
+    static void write_microseconds(std::ostream &stream, clock::duration const &time)
+    {
+        auto const nanoseconds = std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::nanoseconds>(time).count());
+        auto const fraction    = nanoseconds % 1000;
+        stream << nanoseconds / 1000 << "." << char('0' + fraction / 100) << char('0' + fraction / 10 % 10) << char('0' + fraction % 10);
+    }
+
+    // tracers are numbered from one, so a thread's cache can tell them apart
+    static std::atomic<uintmax_t> &next_id()
+    {
+        static std::atomic<uintmax_t> id(0);
+        return id;
+    }
+
+  private:
+    uintmax_t const                             id_;
+    std::string const                           filename_;
+    clock::time_point const                     origin_;
+    mutable std::mutex                          mutex_;
+    std::vector<std::unique_ptr<thread_events>> buffers_;
+};
+
+}   // namespace mapreduce
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
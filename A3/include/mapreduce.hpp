@@ -15,6 +15,7 @@
 #endif
 
 #include <string>
+#include <sstream>
 #include <vector>
 #include <thread>
 #include <cstdint>
@@ -67,8 +68,18 @@ class joined_thread_group : public std::vector<std::thread>
 }   // namespace detail
 }   // namespace mapreduce
 
+#include "detail/tracer.hpp"
+#include "detail/instrumentation.hpp"
+
 namespace mapreduce {
 
+// compression of the files of an intermediate store that spills to disk
+enum class compression
+{
+    none,
+    zlib
+};
+
 struct specification
 {
     size_t          map_tasks;             // ideal number of map tasks to use
@@ -76,12 +87,24 @@ struct specification
     std::string     output_filespec;       // filespec of the output files - can contain a directory path if required
     std::string     input_directory;       // directory path to scan for input files
     std::streamsize max_file_segment_size; // ideal maximum number of bytes in each input file segment
+    bool            per_thread_map_output; // keep one intermediate store per map thread, merged by partition in the shuffle
+    size_t          map_key_batch_size;    // number of keys a map thread claims at once from a datasource with setup_keys
+    size_t          pipeline_buffer_keys;  // keys in a partition of map output before schedule_policy::pipelined hands it on
+    size_t          pipeline_queue_length; // map output buffers queued per partition before a map thread stops to reduce them
+    size_t          spill_memory_budget;   // bytes of intermediate values the stores of a job that spill to disk buffer in memory, shared by the map threads' stores
+    compression     spill_compression;     // codec for the files of an intermediate store that spills to disk
 
     specification()
       : map_tasks(0),                   
         reduce_tasks(1),
         output_filespec("mapreduce_"),
-        max_file_segment_size(1048576L)    // default 1Mb
+        max_file_segment_size(1048576L),   // default 1Mb
+        per_thread_map_output(false),
+        map_key_batch_size(64),
+        pipeline_buffer_keys(1024),
+        pipeline_queue_length(4),
+        spill_memory_budget(64 << 20),     // default 64Mb
+        spill_compression(compression::none)
            
     {
     }
@@ -106,6 +129,28 @@ struct results
 
         size_t num_result_files;        // number of result files created
 
+        // intermediate values emitted by the map tasks, and their estimated
+        // size in bytes, see detail::dynamic_size
+        uintmax_t emitted_values;
+        uintmax_t emitted_bytes;
+
+        // intermediate values the map side combiner folded into an earlier
+        // value of the same key, so were never stored or shuffled
+        uintmax_t combined_values;
+
+        // for intermediate stores that spill to disk, see specification::spill_memory_budget
+        size_t    spill_memory_budget;  // the budget in bytes, or zero if the store does not spill
+        size_t    num_spills;           // times a store reached the budget
+        uintmax_t spilled_bytes;        // bytes those spills wrote to disk, after any compression
+
+        // for specification::spill_compression
+        uintmax_t uncompressed_bytes;   // bytes of intermediate files given to the codec
+        uintmax_t compressed_bytes;     // bytes the codec wrote for them
+
+        // for intermediate stores that allocate from arenas, see arena_allocator
+        uintmax_t arena_allocations_avoided;    // allocations made from an arena less the blocks it took from the heap
+        size_t    arena_peak_bytes;             // bytes held by the largest arena
+
         tag_counters()
           : actual_map_tasks(0),
             actual_reduce_tasks(0),
@@ -115,7 +160,17 @@ struct results
             reduce_keys_executed(0),
             reduce_key_errors(0),
             reduce_keys_completed(0),
-            num_result_files(0)
+            num_result_files(0),
+            emitted_values(0),
+            emitted_bytes(0),
+            combined_values(0),
+            spill_memory_budget(0),
+            num_spills(0),
+            spilled_bytes(0),
+            uncompressed_bytes(0),
+            compressed_bytes(0),
+            arena_allocations_avoided(0),
+            arena_peak_bytes(0)
         {
         }
     } counters;
@@ -124,21 +179,115 @@ struct results
     std::chrono::duration<double>              map_runtime;
     std::chrono::duration<double>              shuffle_runtime;
     std::chrono::duration<double>              reduce_runtime;
-    std::vector<std::chrono::duration<double>> map_times;
-    std::vector<std::chrono::duration<double>> shuffle_times;
-    std::vector<std::chrono::duration<double>> reduce_times;
+
+    // the time of each map key, shuffle and reduce task
+    latency_histogram                          map_times;
+    latency_histogram                          shuffle_times;
+    latency_histogram                          reduce_times;
+
+    // time the threads spent waiting for the job's locks, summed over them
+    std::chrono::duration<double>              lock_wait_time = std::chrono::duration<double>(0);
+
+    // the keys reduced in each partition and the values given to them,
+    // indexed by partition
+    std::vector<uintmax_t>                     partition_keys;
+    std::vector<uintmax_t>                     partition_values;
+
+    // time in the codec of compressed intermediate files, summed over all
+    // threads, and uncompressed_bytes / compressed_bytes
+    std::chrono::duration<double>              compression_runtime;
+    double                                     compression_ratio = 1.0;
+
+    // for intermediate stores that spill single partitions, such as
+    // intermediates::hybrid: the times each partition was spilled, and the
+    // bytes written, indexed by partition. zero for partitions kept in memory
+    std::vector<size_t>                        partition_spills;
+    std::vector<uintmax_t>                     partition_spilled_bytes;
+
+    // the sum of the job's result_reduction over its results, see
+    // job::result_reduction
+    double                                     result_reduction = 0.0;
+
+    // per worker, for schedule policies that report them
+    std::vector<std::chrono::duration<double>> worker_busy_times;
+    std::vector<std::chrono::duration<double>> worker_idle_times;
+
+    // the counters, times and statistics as a JSON object, for monitoring.
+    // times are in seconds
+    std::string to_json() const
+    {
+        std::ostringstream stream;
+        stream.precision(9);
+        stream << "{\"counters\":{"
+               << "\"actual_map_tasks\":"          << counters.actual_map_tasks
+               << ",\"actual_reduce_tasks\":"      << counters.actual_reduce_tasks
+               << ",\"map_keys_executed\":"        << counters.map_keys_executed
+               << ",\"map_key_errors\":"           << counters.map_key_errors
+               << ",\"map_keys_completed\":"       << counters.map_keys_completed
+               << ",\"reduce_keys_executed\":"     << counters.reduce_keys_executed
+               << ",\"reduce_key_errors\":"        << counters.reduce_key_errors
+               << ",\"reduce_keys_completed\":"    << counters.reduce_keys_completed
+               << ",\"num_result_files\":"         << counters.num_result_files
+               << ",\"emitted_values\":"           << counters.emitted_values
+               << ",\"emitted_bytes\":"            << counters.emitted_bytes
+               << ",\"combined_values\":"          << counters.combined_values
+               << ",\"spill_memory_budget\":"      << counters.spill_memory_budget
+               << ",\"num_spills\":"               << counters.num_spills
+               << ",\"spilled_bytes\":"            << counters.spilled_bytes
+               << ",\"uncompressed_bytes\":"       << counters.uncompressed_bytes
+               << ",\"compressed_bytes\":"         << counters.compressed_bytes
+               << ",\"arena_allocations_avoided\":" << counters.arena_allocations_avoided
+               << ",\"arena_peak_bytes\":"         << counters.arena_peak_bytes
+               << "}"
+               << ",\"job_runtime\":"              << job_runtime.count()
+               << ",\"map_runtime\":"              << map_runtime.count()
+               << ",\"shuffle_runtime\":"          << shuffle_runtime.count()
+               << ",\"reduce_runtime\":"           << reduce_runtime.count()
+               << ",\"compression_runtime\":"      << compression_runtime.count()
+               << ",\"compression_ratio\":"        << compression_ratio
+               << ",\"lock_wait_time\":"           << lock_wait_time.count()
+               << ",\"result_reduction\":"         << result_reduction;
+
+        stream << ",\"map_times\":";
+        map_times.to_json(stream);
+        stream << ",\"shuffle_times\":";
+        shuffle_times.to_json(stream);
+        stream << ",\"reduce_times\":";
+        reduce_times.to_json(stream);
+
+        stream << ",\"partition_keys\":";
+        detail::json_array(stream, partition_keys);
+        stream << ",\"partition_values\":";
+        detail::json_array(stream, partition_values);
+        stream << ",\"partition_spills\":";
+        detail::json_array(stream, partition_spills);
+        stream << ",\"partition_spilled_bytes\":";
+        detail::json_array(stream, partition_spilled_bytes);
+        stream << ",\"worker_busy_times\":";
+        detail::json_array(stream, worker_busy_times);
+        stream << ",\"worker_idle_times\":";
+        detail::json_array(stream, worker_idle_times);
+        stream << "}";
+        return stream.str();
+    }
 };
 
 }   // namespace mapreduce
 
 #include <boost/throw_exception.hpp>
 #include "detail/platform.hpp"
+#include "detail/span.hpp"
 #include "detail/mergesort.hpp"
 #include "detail/null_combiner.hpp"
+#include "detail/combiners.hpp"
+#include "detail/arena.hpp"
 #include "detail/intermediates.hpp"
+#include "detail/thread_pool.hpp"
 #include "detail/schedule_policy.hpp"
 #include "detail/datasource.hpp"
 #include "detail/job.hpp"
+#include "detail/iterative_job.hpp"
+#include "detail/reducers.hpp"
 
 namespace mapreduce {
 
@@ -65,35 +65,15 @@ void create_graph_from_inputfile(char* input)
 
 namespace computation_of_pagerank
 {
-    template<typename MapTask>
-class datasource : mapreduce::detail::noncopyable
+struct map_task : public mapreduce::map_task<int, mapreduce::span<int const> >
 {
-  public:
-    datasource() : sequence_(0)
-    {
-    }
-
-    bool const setup_key(typename MapTask::key_type &key)
-    {
-        key = sequence_++;
-        return key < n;
-    }
-
-    bool const get_data(typename MapTask::key_type const &key, typename MapTask::value_type &value)
-    {
-        value=rows[key];
-        return true;
-    }
-
-  private:
-    int sequence_;
-};
+    // the pagerank of the previous iteration
+    typedef vector<double> broadcast_type;
 
-struct map_task : public mapreduce::map_task<int, std::vector<int> >
-{
     template<typename Runtime>
     void operator()(Runtime &runtime, key_type const &key, value_type const &value) const
     {   
+        broadcast_type const &old_pr = runtime.broadcast();
         runtime.emit_intermediate(key, 0.0);
     
         for (auto ci = value.begin(); ci != value.end(); ci++)
@@ -112,23 +92,14 @@ struct map_task : public mapreduce::map_task<int, std::vector<int> >
     }
 };
 
-struct reduce_task : public mapreduce::reduce_task<int, double>
-{
-    template<typename Runtime, typename It>
-    void operator()(Runtime &runtime, key_type const &key, It it, It ite) const
-    {   
-        reduce_task::value_type h=0.0;
-        for (It it1=++it; it1!=ite; ++it1)
-        {
-            h=h + *it1;
-        }
-        runtime.emit(key,h);
-
-    }
-};
+// the combiner sums the values of each node as they are emitted, so the map
+// output holds one value per node rather than one per in-edge
+typedef mapreduce::reducers::sum<int, double> reduce_task;
 
-typedef mapreduce::job<computation_of_pagerank::map_task,computation_of_pagerank::reduce_task,mapreduce::null_combiner,
-computation_of_pagerank::datasource<computation_of_pagerank::map_task> > job;
+typedef mapreduce::job<computation_of_pagerank::map_task,computation_of_pagerank::reduce_task,mapreduce::combiners::sum<double>,
+mapreduce::datasource::container<computation_of_pagerank::map_task, vector< vector<int> > >,
+mapreduce::intermediates::flat_in_memory<computation_of_pagerank::map_task,computation_of_pagerank::reduce_task>,
+mapreduce::intermediates::dense_array_output<computation_of_pagerank::map_task,computation_of_pagerank::reduce_task> > job;
 
 }
 
@@ -153,6 +124,30 @@ void pagerank_calculation() {
     mapreduce::specification spec;
     mapreduce::results result;
     spec.reduce_tasks = std::max(1U, std::thread::hardware_concurrency());
+    spec.per_thread_map_output = true;
+
+    // one set of threads for every phase of every iteration
+    mapreduce::thread_pool pool;
+
+    // the reduce writes the sum for node i straight into reduced[i]
+    computation_of_pagerank::job::result_target_type reduced(num_rows);
+
+    // one job, with its intermediate containers, for every iteration
+    computation_of_pagerank::job::datasource_type datasource(rows);
+    mapreduce::iterative_job<computation_of_pagerank::job, mapreduce::schedule_policy::work_stealing<computation_of_pagerank::job> > pagerank(datasource, spec, pool);
+    pagerank.job().result_target(reduced);
+    pagerank.job().broadcast(old_pr);
+
+    /* An element of the A x I vector and of the 1 x I vector; all elements are identical */
+    double one_Av = 0.0;
+    double one_Iv = 0.0;
+
+    // as each node is reduced, its new pagerank and its change, which the job
+    // sums into the difference to be checked for convergence
+    pagerank.job().result_reduction([&one_Av, &one_Iv](int to, double value) {
+        pr[to] = alpha*value + one_Av + one_Iv;
+        return abs(pr[to] - old_pr[to]);
+    });
     
     while (diff > convergence) 
     {
@@ -176,25 +171,11 @@ void pagerank_calculation() {
             }
         }
         
-        /* An element of the A x I vector; all elements are identical */
-        double one_Av = alpha * dangling_pr/num_rows;
-
-        /* An element of the 1 x I vector; all elements are identical */
-        double one_Iv = (1 - alpha) * 1.0 / num_rows;
+        one_Av = alpha * dangling_pr/num_rows;
+        one_Iv = (1 - alpha) * 1.0 / num_rows;
 
         /* The difference to be checked for convergence */
-        diff = 0.0;
-
-        computation_of_pagerank::job::datasource_type datasource;
-        computation_of_pagerank::job job(datasource, spec);
-        job.run<mapreduce::schedule_policy::cpu_parallel<computation_of_pagerank::job> >(result);
-        
-
-        for (auto it=job.begin_results(); it!=job.end_results(); ++it)
-        {
-            pr[it->first] = alpha*(it->second) + one_Av + one_Iv;
-            diff += abs(pr[it->first] - old_pr[it->first]);
-        }
+        diff = pagerank.run(result);
 
         num_iterations=num_iterations+1;
         